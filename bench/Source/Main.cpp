@@ -0,0 +1,150 @@
+//Main.cpp
+//the benchmark program for the juce_serialport streams. Build it as a JUCE console application with juce_core and the
+//juce_serialport module, and SerialPortBenchmark.cpp alongside this file. Linux only, as it runs over ptys
+//
+//with no arguments every traffic pattern is run over 1, 8, 64 and 512 ports, first with a thread per stream and then
+//with the streams served by a SerialPortReactor. Options:
+//	--traffic bulk|small|pingpong|bursty	only run the one pattern
+//	--ports 1,8,64							the port counts to run
+//	--threads, --reactor					only run the one way of serving the streams
+//	--frame bytes, --duration ms, --burst frames, --gap ms
+//	--loopback /dev/ttyUSB0,/dev/ttyUSB1	ports with their transmit wired to their receive, run instead of ptys
+//	--baud bps, --low-latency				the config the ports are opened with
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <sys/resource.h>
+#include "../../juce_serialport.h"
+#include "SerialPortBenchmark.h"
+
+//every heap allocation in the program goes through here, so the benchmark can report them per megabyte
+static std::atomic<uint64> numAllocations { 0 };
+
+void* operator new (size_t size)
+{
+	++numAllocations;
+	if (void* p = malloc (size > 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[] (size_t size) { return operator new (size); }
+void operator delete (void* p) noexcept { free (p); }
+void operator delete[] (void* p) noexcept { free (p); }
+void operator delete (void* p, size_t) noexcept { free (p); }
+void operator delete[] (void* p, size_t) noexcept { free (p); }
+
+static bool parseTraffic (const String& name, SerialPortBenchmark::trafficpattern& traffic)
+{
+	if (name == "bulk")				traffic = SerialPortBenchmark::TRAFFIC_BULK;
+	else if (name == "small")		traffic = SerialPortBenchmark::TRAFFIC_SMALL_FRAMES;
+	else if (name == "pingpong")	traffic = SerialPortBenchmark::TRAFFIC_PING_PONG;
+	else if (name == "bursty")		traffic = SerialPortBenchmark::TRAFFIC_BURSTY;
+	else return false;
+	return true;
+}
+
+static const char* getTrafficName (SerialPortBenchmark::trafficpattern traffic)
+{
+	switch (traffic)
+	{
+		case SerialPortBenchmark::TRAFFIC_BULK:			return "bulk";
+		case SerialPortBenchmark::TRAFFIC_SMALL_FRAMES:	return "small";
+		case SerialPortBenchmark::TRAFFIC_PING_PONG:	return "pingpong";
+		case SerialPortBenchmark::TRAFFIC_BURSTY:		return "bursty";
+	}
+	return "";
+}
+
+int main (int argc, char* argv[])
+{
+	Array<SerialPortBenchmark::trafficpattern> patterns { SerialPortBenchmark::TRAFFIC_BULK, SerialPortBenchmark::TRAFFIC_SMALL_FRAMES,
+														  SerialPortBenchmark::TRAFFIC_PING_PONG, SerialPortBenchmark::TRAFFIC_BURSTY };
+	Array<int> portCounts { 1, 8, 64, 512 };
+	Array<bool> modes { false, true };
+	SerialPortBenchmark::Options options;
+	options.allocationCounter = [] { return numAllocations.load(); };
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const String arg (argv[i]);
+		const String value (i + 1 < argc ? argv[i + 1] : "");
+		if (arg == "--threads" || arg == "--reactor")
+		{
+			modes = { arg == "--reactor" };
+			continue;
+		}
+		if (arg == "--low-latency")
+		{
+			options.latency = SerialPortConfig::LATENCY_LOW;
+			continue;
+		}
+		++i;
+		if (arg == "--traffic")
+		{
+			SerialPortBenchmark::trafficpattern traffic;
+			if (! parseTraffic (value, traffic))
+			{
+				fprintf (stderr, "unknown traffic pattern: %s\n", value.toRawUTF8());
+				return 1;
+			}
+			patterns = { traffic };
+		}
+		else if (arg == "--ports")
+		{
+			StringArray counts;
+			counts.addTokens (value, ",", "");
+			portCounts.clearQuick();
+			for (auto& count : counts)
+				portCounts.add (jmax (1, count.getIntValue()));
+		}
+		else if (arg == "--loopback")
+			options.loopbackPaths.addTokens (value, ",", "");
+		else if (arg == "--frame")		options.frameSize = value.getIntValue();
+		else if (arg == "--duration")	options.durationMs = value.getIntValue();
+		else if (arg == "--burst")		options.burstFrames = value.getIntValue();
+		else if (arg == "--gap")		options.burstGapMs = value.getIntValue();
+		else if (arg == "--baud")		options.bitsPerSecond = (uint32) value.getIntValue();
+		else
+		{
+			fprintf (stderr, "unknown option: %s\n", arg.toRawUTF8());
+			return 1;
+		}
+	}
+	//the loopback ports are all run at once
+	if (options.loopbackPaths.size() > 0)
+		portCounts = { options.loopbackPaths.size() };
+
+	//each port takes a handful of descriptors, which a few hundred ports can take past the usual soft limit
+	struct rlimit limit;
+	if (getrlimit (RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+
+	bool allSucceeded = true;
+	for (auto traffic : patterns)
+	{
+		for (auto useReactor : modes)
+		{
+			for (auto numPorts : portCounts)
+			{
+				options.traffic = traffic;
+				options.useReactor = useReactor;
+				options.numPorts = numPorts;
+				const auto result = SerialPortBenchmark::run (options);
+				allSucceeded = allSucceeded && result.succeeded;
+				printf ("%-8s %-7s %s\n", getTrafficName (traffic), useReactor ? "reactor" : "threads", result.toString().toRawUTF8());
+				fflush (stdout);
+			}
+		}
+	}
+	return allSucceeded ? 0 : 1;
+}
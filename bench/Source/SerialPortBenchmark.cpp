@@ -0,0 +1,334 @@
+//SerialPortBenchmark.cpp
+//see SerialPortBenchmark.h for details
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "../../juce_serialport.h"
+#include "SerialPortBenchmark.h"
+
+//the far ends of the benchmark's ptys, each echoing back whatever it reads. What can't be written back straight away
+//is held on to, and the end stops reading until it has gone
+class SerialPortBenchmarkEcho : public Thread
+{
+public:
+	struct End
+	{
+		int master;
+		HeapBlock<uint8_t> pending;
+		size_t pendingStart = 0, pendingEnd = 0;
+	};
+
+	SerialPortBenchmarkEcho() : Thread ("SerialBenchmarkEcho")
+	{
+		epollDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+		epoll_event event {};
+		event.events = EPOLLIN;
+		event.data.ptr = nullptr;
+		epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, wakeup.getDescriptor(), &event);
+	}
+
+	~SerialPortBenchmarkEcho()
+	{
+		signalThreadShouldExit();
+		wakeup.signal();
+		waitForThreadToExit (5000);
+		for (auto* end : ends)
+			::close (end->master);
+		::close (epollDescriptor);
+	}
+
+	//returns the path of the new pty's slave end, or an empty string if it couldn't be made
+	String addEnd()
+	{
+		const int master = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		char slavePath[128];
+		if (master == -1 || grantpt (master) != 0 || unlockpt (master) != 0 || ptsname_r (master, slavePath, sizeof (slavePath)) != 0)
+		{
+			if (master != -1)
+				::close (master);
+			return {};
+		}
+		auto* end = ends.add (new End());
+		end->master = master;
+		end->pending.malloc (echoChunkSize);
+		watch (*end, EPOLLIN, EPOLL_CTL_ADD);
+		return String (slavePath);
+	}
+
+	void run() override
+	{
+		epoll_event events[64];
+		while (! threadShouldExit())
+		{
+			const auto numEvents = epoll_wait (epollDescriptor, events, numElementsInArray (events), -1);
+			for (int i = 0; i < numEvents; ++i)
+			{
+				auto* end = static_cast<End*> (events[i].data.ptr);
+				if (end == nullptr)
+					continue;
+				if (end->pendingEnd > end->pendingStart)
+					sendPending (*end);
+				else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+					echo (*end);
+			}
+		}
+	}
+
+private:
+	static const size_t echoChunkSize = 1 << 16;
+
+	void watch (End& end, uint32_t events, int operation)
+	{
+		epoll_event event {};
+		event.events = events;
+		event.data.ptr = &end;
+		epoll_ctl (epollDescriptor, operation, end.master, &event);
+	}
+
+	void echo (End& end)
+	{
+		const auto bytesRead = ::read (end.master, end.pending, echoChunkSize);
+		if (bytesRead <= 0)
+		{
+			//the slave end has been closed, or is going
+			if (bytesRead == 0 || (errno != EAGAIN && errno != EINTR))
+				epoll_ctl (epollDescriptor, EPOLL_CTL_DEL, end.master, nullptr);
+			return;
+		}
+		end.pendingStart = 0;
+		end.pendingEnd = (size_t) bytesRead;
+		sendPending (end);
+	}
+
+	void sendPending (End& end)
+	{
+		const auto written = ::write (end.master, end.pending + end.pendingStart, end.pendingEnd - end.pendingStart);
+		if (written > 0)
+			end.pendingStart += (size_t) written;
+		const bool done = end.pendingStart == end.pendingEnd;
+		watch (end, done ? EPOLLIN : EPOLLOUT, EPOLL_CTL_MOD);
+	}
+
+	int epollDescriptor;
+	SerialPortWakeup wakeup;
+	OwnedArray<End> ends;
+};
+
+//one port, and the thread that sends it frames and times their echoes
+class SerialPortBenchmarkDriver : public Thread
+{
+public:
+	SerialPortBenchmarkDriver (const String& path, const SerialPortBenchmark::Options& o, SerialPortReactor* reactor)
+		: Thread ("SerialBenchmarkDriver"), options (o), port (path, nullptr)
+	{
+		if (! port.exists())
+			return;
+		SerialPortConfig config (o.bitsPerSecond, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+		config.latency = o.latency;
+		if (! port.setConfig (config))
+			return;
+		if (reactor != nullptr)
+		{
+			input.reset (new SerialPortInputStream (&port, *reactor));
+			output.reset (new SerialPortOutputStream (&port, *reactor));
+		}
+		else
+		{
+			input.reset (new SerialPortInputStream (&port));
+			output.reset (new SerialPortOutputStream (&port));
+		}
+	}
+
+	~SerialPortBenchmarkDriver()
+	{
+		signalThreadShouldExit();
+		waitForThreadToExit (5000);
+	}
+
+	bool isOpen() const { return input != nullptr; }
+
+	void run() override
+	{
+		int frameSize = options.frameSize;
+		int window = 1;
+		switch (options.traffic)
+		{
+			case SerialPortBenchmark::TRAFFIC_BULK:         frameSize = frameSize > 0 ? frameSize : 4096; window = 16; break;
+			case SerialPortBenchmark::TRAFFIC_SMALL_FRAMES: frameSize = frameSize > 0 ? frameSize : 16; window = 64; break;
+			case SerialPortBenchmark::TRAFFIC_PING_PONG:    frameSize = frameSize > 0 ? frameSize : 64; window = 1; break;
+			case SerialPortBenchmark::TRAFFIC_BURSTY:       frameSize = frameSize > 0 ? frameSize : 16; window = jmax (1, options.burstFrames); break;
+		}
+		HeapBlock<uint8_t> frame ((size_t) frameSize);
+		for (int i = 0; i < frameSize; ++i)
+			frame[i] = (uint8_t) i;
+		HeapBlock<uint8_t> received (receiveSize);
+		HeapBlock<int64> sendTimes ((size_t) window);
+		uint64 numSent = 0, numReturned = 0;
+		size_t partFrame = 0;
+		const auto deadline = SerialPortInputStream::getTimestampNanos() + (int64) options.durationMs * 1000000;
+		while (! threadShouldExit())
+		{
+			const bool bursty = options.traffic == SerialPortBenchmark::TRAFFIC_BURSTY;
+			if (bursty && numSent > 0 && numSent == numReturned)
+				Thread::sleep (options.burstGapMs);
+			//a bursty port only sends again once the whole burst has come back
+			if (! bursty || numSent == numReturned)
+			{
+				while (numSent - numReturned < (uint64) window)
+				{
+					sendTimes[numSent % (uint64) window] = SerialPortInputStream::getTimestampNanos();
+					if (! output->write (frame, (size_t) frameSize))
+						return;
+					++numSent;
+				}
+			}
+			const auto numRead = input->readAtLeast (received, 1, (int) receiveSize, 100);
+			const auto now = SerialPortInputStream::getTimestampNanos();
+			if (numRead < 0 || now >= deadline)
+				break;
+			bytes += (uint64) numRead;
+			partFrame += (size_t) numRead;
+			for (; partFrame >= (size_t) frameSize; partFrame -= (size_t) frameSize)
+				roundTrips.record (now - sendTimes[numReturned++ % (uint64) window]);
+		}
+	}
+
+	const SerialPortBenchmark::Options& options;
+	SerialPort port;
+	std::unique_ptr<SerialPortInputStream> input;
+	std::unique_ptr<SerialPortOutputStream> output;
+	SerialPortLatencyHistogram roundTrips;
+	uint64 bytes = 0;
+
+private:
+	static const size_t receiveSize = 1 << 16;
+};
+
+static double getProcessCpuSeconds (const struct rusage& usage)
+{
+	return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+static int getProcessThreadCount()
+{
+	FILE* status = fopen ("/proc/self/status", "r");
+	if (status == nullptr)
+		return 0;
+	char line[256];
+	int numThreads = 0;
+	while (fgets (line, sizeof (line), status) != nullptr)
+		if (sscanf (line, "Threads: %d", &numThreads) == 1)
+			break;
+	fclose (status);
+	return numThreads;
+}
+
+//ru_maxrss is the peak, which only ever goes up over a sweep of runs, so the current size is read instead
+static int64 getProcessResidentBytes()
+{
+	FILE* statm = fopen ("/proc/self/statm", "r");
+	if (statm == nullptr)
+		return 0;
+	long long pages = 0, residentPages = 0;
+	const bool read = fscanf (statm, "%lld %lld", &pages, &residentPages) == 2;
+	fclose (statm);
+	return read ? (int64) residentPages * (int64) sysconf (_SC_PAGESIZE) : 0;
+}
+
+SerialPortBenchmark::Result SerialPortBenchmark::run (const Options& options)
+{
+	Result result;
+	const auto threadsBefore = getProcessThreadCount();
+	const auto residentBefore = getProcessResidentBytes();
+	SerialPortBenchmarkEcho echo;
+	std::unique_ptr<SerialPortReactor> reactor (options.useReactor ? new SerialPortReactor() : nullptr);
+	OwnedArray<SerialPortBenchmarkDriver> drivers;
+	const bool loopback = options.loopbackPaths.size() > 0;
+	result.numPorts = loopback ? options.loopbackPaths.size() : options.numPorts;
+	result.latencySettingsApplied = SerialPort::LATENCY_SETTING_LOW_LATENCY_FLAG | SerialPort::LATENCY_SETTING_USB_LATENCY_TIMER;
+	for (int i = 0; i < result.numPorts; ++i)
+	{
+		const auto path = loopback ? options.loopbackPaths[i] : echo.addEnd();
+		auto* driver = path.isEmpty() ? nullptr : drivers.add (new SerialPortBenchmarkDriver (path, options, reactor.get()));
+		if (driver == nullptr || ! driver->isOpen())
+		{
+			result.error = "couldn't open " + (loopback ? path : "pty " + String (i + 1) + " of " + String (result.numPorts)) + ", errno: " + String (errno);
+			return result;
+		}
+		result.latencySettingsApplied &= driver->port.getLatencySettingsApplied();
+	}
+	echo.startThread();
+
+	const auto allocationsBefore = options.allocationCounter != nullptr ? options.allocationCounter() : 0;
+	struct rusage usageBefore, usageAfter;
+	getrusage (RUSAGE_SELF, &usageBefore);
+	const auto start = SerialPortInputStream::getTimestampNanos();
+	for (auto* driver : drivers)
+		driver->startThread();
+	result.numThreads = jmax (0, getProcessThreadCount() - threadsBefore - 1 - drivers.size());
+	for (auto* driver : drivers)
+		driver->waitForThreadToExit (-1);
+	result.seconds = (double) (SerialPortInputStream::getTimestampNanos() - start) / 1.0e9;
+	getrusage (RUSAGE_SELF, &usageAfter);
+	result.residentBytes = getProcessResidentBytes() - residentBefore;
+	const auto cpuSeconds = getProcessCpuSeconds (usageAfter) - getProcessCpuSeconds (usageBefore);
+	result.voluntaryContextSwitches = (int64) (usageAfter.ru_nvcsw - usageBefore.ru_nvcsw);
+	result.involuntaryContextSwitches = (int64) (usageAfter.ru_nivcsw - usageBefore.ru_nivcsw);
+	const auto allocations = options.allocationCounter != nullptr ? options.allocationCounter() - allocationsBefore : 0;
+
+	std::unique_ptr<SerialPortLatencyHistogram::Snapshot> all (new SerialPortLatencyHistogram::Snapshot()), one (new SerialPortLatencyHistogram::Snapshot());
+	for (int i = 0; i < SerialPortLatencyHistogram::numBuckets; ++i)
+		all->counts[i] = 0;
+	for (auto* driver : drivers)
+	{
+		result.bytes += driver->bytes;
+		driver->roundTrips.getSnapshot (*one);
+		for (int i = 0; i < SerialPortLatencyHistogram::numBuckets; ++i)
+			all->counts[i] += one->counts[i];
+		all->total += one->total;
+	}
+	const auto megabytes = (double) result.bytes / (1024.0 * 1024.0);
+	result.megabytesPerSecond = result.seconds > 0 ? megabytes / result.seconds : 0;
+	result.roundTripNanos50 = all->getValueAtPercentile (50.0);
+	result.roundTripNanos99 = all->getValueAtPercentile (99.0);
+	result.roundTripNanos999 = all->getValueAtPercentile (99.9);
+	if (megabytes > 0)
+	{
+		result.cpuSecondsPerMegabyte = cpuSeconds / megabytes;
+		if (options.allocationCounter != nullptr)
+			result.allocationsPerMegabyte = (double) allocations / megabytes;
+	}
+	result.succeeded = true;
+	return result;
+}
+
+String SerialPortBenchmark::Result::toString() const
+{
+	if (! succeeded)
+		return "failed: " + error;
+	String s;
+	s << numPorts << " ports: " << String (megabytesPerSecond, 2) << " MB/s, round trip p50 " << String (roundTripNanos50 / 1000.0, 1)
+	  << "us p99 " << String (roundTripNanos99 / 1000.0, 1) << "us p999 " << String (roundTripNanos999 / 1000.0, 1)
+	  << "us, " << String (cpuSecondsPerMegabyte * 1000.0, 2) << " cpu ms/MB";
+	if (allocationsPerMegabyte >= 0)
+		s << ", " << String (allocationsPerMegabyte, 1) << " allocations/MB";
+	s << ", " << numThreads << " threads, " << String ((double) residentBytes / (1024.0 * 1024.0), 1) << " MB resident, "
+	  << voluntaryContextSwitches << "/" << involuntaryContextSwitches << " context switches";
+	if (latencySettingsApplied != 0)
+	{
+		s << ", low latency";
+		if ((latencySettingsApplied & SerialPort::LATENCY_SETTING_LOW_LATENCY_FLAG) != 0)
+			s << " flag";
+		if ((latencySettingsApplied & SerialPort::LATENCY_SETTING_USB_LATENCY_TIMER) != 0)
+			s << " timer";
+	}
+	return s;
+}
@@ -0,0 +1,68 @@
+//SerialPortBenchmark.h
+//the pty benchmark for the juce_serialport streams. It's only built into the benchmark program in bench/, so none of
+//this goes into an application using the module
+//
+
+#ifndef _SERIALPORTBENCHMARK_H_
+#define _SERIALPORTBENCHMARK_H_
+
+//////////////////////////////////////////////////////////////////
+//measures the streams against pseudo terminals, so no hardware is needed. The far end of each port echoes everything
+//straight back from a thread of its own, so the figures cover the whole way out through SerialPortOutputStream and
+//back in through SerialPortInputStream. Each port is driven by a thread that writes frames and reads their echoes:
+//TRAFFIC_BULK keeps 16 large frames in flight, TRAFFIC_SMALL_FRAMES keeps 64 small ones in flight, TRAFFIC_PING_PONG
+//waits for each frame to come back before sending the next, and TRAFFIC_BURSTY sends burstFrames back to back, waits
+//for them all to come back, then pauses for burstGapMs
+class SerialPortBenchmark
+{
+public:
+	enum trafficpattern{TRAFFIC_BULK=0, TRAFFIC_SMALL_FRAMES, TRAFFIC_PING_PONG, TRAFFIC_BURSTY};
+	struct Options
+	{
+		trafficpattern traffic = TRAFFIC_BULK;
+		int numPorts = 1;
+		//0 picks the pattern's own, 4096 for bulk, 64 for ping-pong and 16 for the others
+		int frameSize = 0;
+		int durationMs = 2000;
+		int burstFrames = 32;
+		int burstGapMs = 5;
+		//serve all the streams from one SerialPortReactor, instead of each having a thread
+		bool useReactor = false;
+		//ports with their transmit wired to their receive, used instead of ptys, one for each path. Only these can show
+		//what LATENCY_LOW does, as a pty has no driver settings to change
+		juce::StringArray loopbackPaths;
+		juce::uint32 bitsPerSecond = 115200;
+		SerialPortConfig::SerialPortLatency latency = SerialPortConfig::LATENCY_DEFAULT;
+		//the number of heap allocations made so far, if the application counts them (by replacing operator new).
+		//without it allocationsPerMegabyte is left at -1
+		std::function<juce::uint64()> allocationCounter;
+	};
+	struct Result
+	{
+		bool succeeded = false;
+		juce::String error;
+		int numPorts = 0;
+		//echoed back and read, over all the ports
+		juce::uint64 bytes = 0;
+		double seconds = 0;
+		double megabytesPerSecond = 0;
+		//from a frame being written to the last of it being read back
+		juce::int64 roundTripNanos50 = 0, roundTripNanos99 = 0, roundTripNanos999 = 0;
+		//the whole process's user and system time, so it includes the echoing
+		double cpuSecondsPerMegabyte = 0;
+		double allocationsPerMegabyte = -1;
+		//the SerialPort::latencysetting flags that were applied on every port
+		int latencySettingsApplied = 0;
+		//what serving the ports costs the process, to compare a thread per stream with the reactor. The context switches
+		//are the whole process's over the run, like the cpu time. numThreads leaves out the benchmark's own (the drivers
+		//and the echo thread), and residentBytes is how much the process grew by from before the ports were opened
+		juce::int64 voluntaryContextSwitches = 0, involuntaryContextSwitches = 0;
+		int numThreads = 0;
+		juce::int64 residentBytes = 0;
+
+		juce::String toString() const;
+	};
+	static Result run (const Options& options);
+};
+
+#endif //_SERIALPORTBENCHMARK_H_
@@ -51,6 +51,18 @@ a typical serialport scenario may be:
 			while(pInputStream->canReadLine())
 				s = pInputStream->readNextLine();
 
+			//or, without allocating, as views of CRLF terminated lines of up to 256 bytes:
+			pInputStream->setLineEnding(SerialPortInputStream::LINE_CRLF);
+			pInputStream->setMaxLineLength(256);
+			std::string_view line;
+			while(pInputStream->readLine(line))
+				parse(line);
+
+			//or, for a request and reply, block until the 8 byte reply arrives, for at most 50ms:
+			uint8_t reply[8];
+			if(pInputStream->readExactly(reply, 8, 50) == 8)
+				handleReply(reply);
+
 			//or ask to be notified when a new line is available:
 			pInputStreams->addChangeListener(this); //we must be a ChangeListener to receive notifications
 			pInputStream->setNotify(SerialPortInputStream::NOTIFY_ON_CHAR, '\n');
@@ -58,8 +70,26 @@ a typical serialport scenario may be:
 			//or ask to be notified whenever any character is received
 			//NOTE - use with care at high baud rates!!!!
 			pInputStream->setNotify(SerialPortInputStream::NOTIFY_ALWAYS);
+			//at high baud rates, limit it to at most one notification every 5ms
+			SerialPortInputStream::NotifyPolicy policy;
+			policy.minIntervalMicroseconds = 5000;
+			pInputStream->setNotifyPolicy(policy);
+
+			//on Linux, many ports can share one thread instead of each stream starting its own:
+			//SerialPortReactor reactor;
+			//SerialPortInputStream in(pSP, reactor);
+
+			//or, with no hardware at all, two ports joined back to back inside the process:
+			//SerialPortVirtualPair pair;
+			//SerialPortOutputStream out(&pair.getEnd(0));
+			//SerialPortInputStream in(&pair.getEnd(1));
 
-			//please see class definitions for other features/functions etc		
+			//on Linux, find an adapter by its serial number, and be told when ports come and go:
+			//SerialPortInfo info;
+			//if (SerialPortEnumerator::getShared().findBySerialNumber("A50285BI", info)) ...
+			//SerialPortMonitor monitor(*this); //we must be a SerialPortMonitor::Listener
+
+			//please see class definitions for other features/functions etc
 		}
 	}
 }
@@ -69,6 +99,8 @@ a typical serialport scenario may be:
 #define _SERIALPORT_H_
 
 #include <stdint.h>
+#include <atomic>
+#include <string_view>
 
 #if JUCE_ANDROID
 	#include <jni.h>
@@ -76,6 +108,8 @@ a typical serialport scenario may be:
 
 using DebugFunction = std::function<void (juce::String, juce::String)>;
 
+class SerialPortVirtualPair;
+
 class JUCE_API SerialPortConfig
 {
 public:
@@ -85,6 +119,9 @@ public:
 	enum SerialPortStopBits{STOPBITS_1, STOPBITS_1ANDHALF, STOPBITS_2};
 	enum SerialPortFlowControl{FLOWCONTROL_NONE, FLOWCONTROL_HARDWARE, FLOWCONTROL_XONXOFF};
 	enum SerialPortParity{SERIALPORT_PARITY_NONE, SERIALPORT_PARITY_ODD, SERIALPORT_PARITY_EVEN, SERIALPORT_PARITY_SPACE, SERIALPORT_PARITY_MARK};
+	//LATENCY_LOW asks the driver to pass each byte on as soon as it arrives instead of saving them up, at the cost of
+	//more interrupts and wakeups. Only Linux does anything with it, see SerialPort::getLatencySettingsApplied()
+	enum SerialPortLatency{LATENCY_DEFAULT, LATENCY_LOW};
 
 	SerialPortConfig(uint32_t bps, uint32_t databits, SerialPortParity parity, SerialPortStopBits stopbits, SerialPortFlowControl flowcontrol) :
         bps(bps), databits(databits), parity(parity), stopbits(stopbits), flowcontrol(flowcontrol) {}
@@ -93,6 +130,189 @@ public:
 	SerialPortParity parity;
 	SerialPortStopBits stopbits;
 	SerialPortFlowControl flowcontrol;
+	SerialPortLatency latency = LATENCY_DEFAULT;
+};
+
+#if JUCE_LINUX || JUCE_MAC
+//////////////////////////////////////////////////////////////////
+//a descriptor that can be polled alongside the port's, so a thread waiting on the port can be woken up straight away.
+//an eventfd on Linux and a self-pipe on the Mac. It stays readable from signal() until clear()
+class JUCE_API SerialPortWakeup
+{
+public:
+	SerialPortWakeup();
+	~SerialPortWakeup();
+	void signal();
+	void clear();
+	int getDescriptor() const {return readDescriptor;}
+private:
+	int readDescriptor;
+	int writeDescriptor;
+};
+#endif
+
+//////////////////////////////////////////////////////////////////
+//a histogram of latencies in nanoseconds, with 16 buckets to each power of two, so any value is within about 6% of the
+//bucket it's counted in. Values from 2^40ns (about 18 minutes) up all go in the last bucket. One thread may record()
+//into it while any number of others take snapshots, without anyone taking a lock
+class JUCE_API SerialPortLatencyHistogram
+{
+public:
+	static const int subBucketBits = 4;
+	static const int numSubBuckets = 1 << subBucketBits;
+	static const int maxValueBits = 40;
+	static const int numBuckets = (maxValueBits - subBucketBits + 1) * numSubBuckets;
+
+	void record (juce::int64 nanos)
+	{
+		const auto value = (juce::uint64) juce::jlimit ((juce::int64) 0, ((juce::int64) 1 << maxValueBits) - 1, nanos);
+		const auto oldSequence = sequence.load (std::memory_order_relaxed);
+		//odd while the counts are being changed
+		sequence.store (oldSequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_release);
+		auto& count = counts[getBucket (value)];
+		count.store (count.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		total.store (total.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sum.store (sum.load (std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		if (value > maximum.load (std::memory_order_relaxed))
+			maximum.store (value, std::memory_order_relaxed);
+		sequence.store (oldSequence + 2, std::memory_order_release);
+	}
+
+	struct Snapshot
+	{
+		juce::uint64 counts[numBuckets];
+		juce::uint64 total = 0;
+		juce::uint64 sum = 0;
+		juce::uint64 maximum = 0;
+
+		double getMean() const { return total > 0 ? (double) sum / (double) total : 0.0; }
+		//the lowest value in the bucket that the given percentage of the values are at or below
+		juce::int64 getValueAtPercentile (double percentile) const
+		{
+			const auto wanted = (juce::uint64) std::ceil ((double) total * juce::jlimit (0.0, 100.0, percentile) / 100.0);
+			juce::uint64 seen = 0;
+			for (int i = 0; i < numBuckets; ++i)
+				if ((seen += counts[i]) >= wanted && seen > 0)
+					return (juce::int64) getBucketStart (i);
+			return 0;
+		}
+	};
+
+	//a consistent copy of the counts, taken again if record() changes them part way through
+	void getSnapshot (Snapshot& snapshot) const
+	{
+		for (;;)
+		{
+			const auto startSequence = sequence.load (std::memory_order_acquire);
+			if ((startSequence & 1) == 0)
+			{
+				for (int i = 0; i < numBuckets; ++i)
+					snapshot.counts[i] = counts[i].load (std::memory_order_relaxed);
+				snapshot.total = total.load (std::memory_order_relaxed);
+				snapshot.sum = sum.load (std::memory_order_relaxed);
+				snapshot.maximum = maximum.load (std::memory_order_relaxed);
+				std::atomic_thread_fence (std::memory_order_acquire);
+				if (sequence.load (std::memory_order_relaxed) == startSequence)
+					return;
+			}
+			juce::Thread::yield();
+		}
+	}
+
+	static int getBucket (juce::uint64 value)
+	{
+		if (value < (juce::uint64) numSubBuckets)
+			return (int) value;
+		int highestBit = 0;
+		for (int step = 32; step > 0; step >>= 1)
+			if ((value >> (highestBit + step)) != 0)
+				highestBit += step;
+		//the highest bit and the subBucketBits below it pick the bucket
+		const int shift = highestBit - subBucketBits;
+		return shift * numSubBuckets + (int) ((value >> shift) & (numSubBuckets - 1)) + numSubBuckets;
+	}
+
+	static juce::uint64 getBucketStart (int bucket)
+	{
+		if (bucket < numSubBuckets)
+			return (juce::uint64) bucket;
+		const int shift = bucket / numSubBuckets - 1;
+		return (juce::uint64) (bucket - shift * numSubBuckets) << shift;
+	}
+
+private:
+	std::atomic<juce::uint32> sequence { 0 };
+	std::atomic<juce::uint64> counts[numBuckets] {};
+	std::atomic<juce::uint64> total { 0 };
+	std::atomic<juce::uint64> sum { 0 };
+	std::atomic<juce::uint64> maximum { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+//what a port's streams have been doing, kept up to date by the streams themselves and readable at any time. The counts
+//are only ever added to, so the difference between two snapshots shows what happened in between
+class JUCE_API SerialPortStatistics
+{
+public:
+	struct Counts
+	{
+		//chunks are the pieces the data came from the driver in, or went to it in
+		juce::uint64 bytesIn = 0, chunksIn = 0, readCalls = 0, readerWakeups = 0, bytesDroppedIn = 0;
+		juce::uint64 bytesOut = 0, chunksOut = 0, writeCalls = 0, writerWakeups = 0, bytesDroppedOut = 0;
+		//the most that has been waiting in each stream's buffer at once
+		size_t inputQueueHighWater = 0, outputQueueHighWater = 0;
+	};
+	Counts getCounts() const
+	{
+		Counts c;
+		c.bytesIn = bytesIn;
+		c.chunksIn = chunksIn;
+		c.readCalls = readCalls;
+		c.readerWakeups = readerWakeups;
+		c.bytesDroppedIn = bytesDroppedIn;
+		c.bytesOut = bytesOut;
+		c.chunksOut = chunksOut;
+		c.writeCalls = writeCalls;
+		c.writerWakeups = writerWakeups;
+		c.bytesDroppedOut = bytesDroppedOut;
+		c.inputQueueHighWater = inputQueueHighWater;
+		c.outputQueueHighWater = outputQueueHighWater;
+		return c;
+	}
+	//how long written data waits before it is handed to the driver, measured from the write() call
+	void getWriteLatency (SerialPortLatencyHistogram::Snapshot& snapshot) const { writeLatency.getSnapshot (snapshot); }
+	//how long received data waits in the input buffer, from being taken from the driver to being read
+	void getReadLatency (SerialPortLatencyHistogram::Snapshot& snapshot) const { readLatency.getSnapshot (snapshot); }
+
+private:
+	friend class SerialPortInputStream;
+	friend class SerialPortOutputStream;
+	friend class SerialPortVirtualPair;
+#if JUCE_LINUX
+	friend class SerialPortReactor;
+#endif
+	static void add (std::atomic<juce::uint64>& counter, juce::uint64 amount) { counter.fetch_add (amount, std::memory_order_relaxed); }
+	//only called by the one thread that adds to that queue
+	static void noteQueueSize (std::atomic<size_t>& highWater, size_t numBytes)
+	{
+		if (numBytes > highWater.load (std::memory_order_relaxed))
+			highWater.store (numBytes, std::memory_order_relaxed);
+	}
+	void countWriteCall (long bytesWritten)
+	{
+		add (writeCalls, 1);
+		if (bytesWritten > 0)
+		{
+			add (chunksOut, 1);
+			add (bytesOut, (juce::uint64) bytesWritten);
+		}
+	}
+
+	std::atomic<juce::uint64> bytesIn { 0 }, chunksIn { 0 }, readCalls { 0 }, readerWakeups { 0 }, bytesDroppedIn { 0 };
+	std::atomic<juce::uint64> bytesOut { 0 }, chunksOut { 0 }, writeCalls { 0 }, writerWakeups { 0 }, bytesDroppedOut { 0 };
+	std::atomic<size_t> inputQueueHighWater { 0 }, outputQueueHighWater { 0 };
+	SerialPortLatencyHistogram writeLatency, readLatency;
 };
 
 //////////////////////////////////////////////////////////////////
@@ -103,6 +323,7 @@ public:
 	{
 		portHandle = 0;
 		portDescriptor = -1;
+		canceled = false;
 	}
     SerialPort (const juce::String& portPath, DebugFunction theDebugLog) : SerialPort (theDebugLog)
 	{
@@ -110,53 +331,406 @@ public:
 	}
     SerialPort (const juce::String& portPath, const SerialPortConfig& config, DebugFunction theDebugLog) : SerialPort (theDebugLog)
 	{
-		open(portPath);
-		setConfig(config);
+		openWithConfig(portPath, config);
 	}
 	virtual ~SerialPort()
 	{
 		close();
 	}
 	bool open(const juce::String & portPath);
+	//the same as open() then setConfig(), but on Linux the port's settings are only set the once. Returns false if
+	//either part fails. If it was only the settings that failed the port is left open, set up as open() would leave it
+	bool openWithConfig(const juce::String & portPath, const SerialPortConfig & config);
+	//a port opened by openAll(), and how long that took. port is nullptr if it couldn't be opened and configured
+	struct OpenedPort
+	{
+		juce::String path;
+		std::unique_ptr<SerialPort> port;
+		double milliseconds = 0;
+	};
+	//opens and configures all the ports at once with openWithConfig(), spread over up to numThreads threads, as some
+	//usb adapters keep open() waiting on the device for milliseconds. The results are in the same order as the paths
+	static void openAll (const juce::StringArray& paths, const SerialPortConfig& config, juce::OwnedArray<OpenedPort>& results,
+	                     int numThreads = 8, DebugFunction debugLog = nullptr);
+	//the streams on the port have to be destroyed before it is closed, as close() doesn't wait for their threads, or the
+	//reactor, to stop using the descriptor. They close it themselves if the port hangs up, and then stop
 	void close();
 	bool setConfig(const SerialPortConfig & config);
 	bool getConfig(SerialPortConfig & config);
+	//changes the speed and nothing else, for switching part way through a session the way bootloaders do. Any whole
+	//number of bits per second the driver can make is allowed, not just the standard rates
+	bool setBaudRate (juce::uint32 bitsPerSecond);
 	juce::String getPortPath(){return portPath;}
 	static juce::StringPairArray getSerialPortPaths();
 	bool exists();
+	//how many bytes the driver is holding that it hasn't transmitted yet, or -1 if that can't be found out. doesn't block
+	int getNumBytesQueued();
+	//waits until the driver has transmitted everything it was given, or timeoutMs has passed (-1 waits forever).
+	//returns false if it timed out, or the port was closed or cancelled first
+	bool drain (int timeoutMs = -1);
     virtual void cancel ();
 	void DebugLog (juce::String prefix, juce::String msg) { if (DebugLogInternal != nullptr) DebugLogInternal (prefix, msg); }
+	//kept up to date by the streams using this port
+	const SerialPortStatistics& getStatistics() const { return statistics; }
+	//true for the ends of a SerialPortVirtualPair, which aren't driver ports at all
+	bool isVirtual() const { return virtualPair != nullptr; }
+	//which of the driver's settings the last setConfig() with LATENCY_LOW managed to change, as latencysetting flags.
+	//the low latency flag makes the tty layer hand received bytes over without deferring them to a work queue. The
+	//latency timer is how long a USB adapter such as an FTDI holds on to a part filled packet, 16ms unless changed,
+	//and usually needs write access to sysfs. Both are put back when the port is closed or set to LATENCY_DEFAULT
+	enum latencysetting{LATENCY_SETTING_LOW_LATENCY_FLAG=1, LATENCY_SETTING_USB_LATENCY_TIMER=2};
+	int getLatencySettingsApplied() const { return latencySettingsApplied; }
 
 	juce_UseDebuggingNewOperator
 private:
 	friend class SerialPortInputStream;
 	friend class SerialPortOutputStream;
+	friend class SerialPortVirtualPair;
+#if JUCE_LINUX
+	friend class SerialPortReactor;
+#endif
 	void * portHandle;
 	int portDescriptor;
     bool canceled;
 	juce::String portPath;
 
     DebugFunction DebugLogInternal;
+	SerialPortStatistics statistics;
+	SerialPortVirtualPair* virtualPair = nullptr;
+	int virtualEnd = 0;
+	int latencySettingsApplied = 0;
+#if JUCE_LINUX
+	//opens the descriptor, without setting anything up yet
+	bool openDescriptor (const juce::String& portPath);
+	//the raw settings open() leaves the port with. Closes the port if they can't be set
+	bool setRawSettings();
+	//changes the driver's latency settings, remembering what they were, or puts them back
+	void setDriverLatency (bool low);
+	bool lowLatencyFlagChanged = false;
+	int originalLatencyTimer = -1;
+	//what the last setConfig() or setBaudRate() put on the port since it was opened, so they can leave out what
+	//hasn't changed. Anything else changing the tty's settings behind their back isn't noticed
+	SerialPortConfig appliedConfig;
+	bool configApplied = false;
+	bool latencyApplied = false;
+#endif
 
+#if JUCE_LINUX || JUCE_MAC
+	//signalled by cancel() and close(), and polled by both stream threads, so they stop as soon as the port does
+	SerialPortWakeup cancelWakeup;
+#endif
 #if JUCE_ANDROID
     jobject usbSerialHelper;
 #endif
 };
 
+#if JUCE_LINUX
+//////////////////////////////////////////////////////////////////
+//what sysfs knows about a port. The usb fields are only filled in for usb adapters
+struct JUCE_API SerialPortInfo
+{
+	//ttyUSB0, and /dev/ttyUSB0
+	juce::String name;
+	juce::String path;
+	//the /dev/serial/by-id link to the port, which doesn't change with the order adapters are plugged in, if udev made one
+	juce::String byIdPath;
+	//the kernel driver, such as ftdi_sio, cdc_acm or serial8250
+	juce::String driver;
+	int vendorId = -1, productId = -1;
+	int interfaceNumber = -1;
+	juce::String serialNumber, manufacturer, product;
+};
+
+//the ports and what sysfs knows about them. The list is kept, and only made again once a tty has come or gone from
+///dev since. An inotify watch says when that is without any polling, so asking again and again costs a read() that
+//has nothing to return. Everything can be called from any thread
+class JUCE_API SerialPortEnumerator
+{
+public:
+	SerialPortEnumerator();
+	~SerialPortEnumerator();
+	juce::Array<SerialPortInfo> getPorts();
+	//by the device path or the by-id one
+	bool findByPath (const juce::String& path, SerialPortInfo& result);
+	//adapters with more than one port have the same serial number on each. An interfaceNumber of -1 takes any of them
+	bool findBySerialNumber (const juce::String& serialNumber, SerialPortInfo& result, int interfaceNumber = -1);
+	juce::Array<SerialPortInfo> findByVendorAndProduct (int vendorId, int productId);
+	//has the list made again next time, whether or not anything seems to have changed
+	void invalidate();
+	//how many times the list has been made
+	juce::uint64 getNumScans() const { return numScans; }
+	//the one getSerialPortPaths() uses
+	static SerialPortEnumerator& getShared();
+
+private:
+	//called with the lock held
+	void updateIfChanged();
+	void scan();
+	void watchDirectories();
+
+	juce::CriticalSection lock;
+	juce::Array<SerialPortInfo> ports;
+	//indexes into ports. The serial numbers are in there on their own, and with "/" and the interface number after them
+	juce::HashMap<juce::String, int> pathIndex, serialNumberIndex;
+	juce::HashMap<juce::int64, juce::Array<int>> vendorProductIndex;
+	int inotifyDescriptor;
+	//the watches on /dev/serial and /dev/serial/by-id, which only exist once udev has made a link
+	int serialWatch = -1, byIdWatch = -1;
+	bool stale = true;
+	std::atomic<juce::uint64> numScans { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortEnumerator)
+};
+
+//tells a listener when serial ports come and go, as the kernel announces them on a NETLINK_KOBJECT_UEVENT socket, with
+//no polling. Where the socket can't be had, as in some containers, it watches /dev with inotify instead. The listener
+//is called on the monitor's thread, with what the enumerator knows about the port. udev makes the by-id link after
+//the kernel has announced the port, so that may not be there yet
+class JUCE_API SerialPortMonitor : private juce::Thread
+{
+public:
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		virtual void serialPortAdded (const SerialPortInfo& port) = 0;
+		virtual void serialPortRemoved (const SerialPortInfo& port) = 0;
+	};
+	//the ports there already aren't reported. With watchPseudoTerminals, ptys coming and going in /dev/pts are reported
+	//too, with a driver of "pty", which makes it easy to try out
+	SerialPortMonitor (Listener& listener, bool watchPseudoTerminals = false, SerialPortEnumerator& enumerator = SerialPortEnumerator::getShared());
+	~SerialPortMonitor();
+	bool isUsingNetlink() const { return netlinkDescriptor != -1; }
+	//handles a message in the kernel's uevent format, "ACTION=add\0SUBSYSTEM=tty\0DEVNAME=ttyUSB0\0" and so on, the same
+	//as one from the socket, so tests can feed it made up events. Can be called from any thread
+	void handleUevent (const char* message, size_t length);
+	void run() override;
+
+private:
+	void readUevents();
+	void readInotifyEvents();
+	void portAdded (const juce::String& name);
+	void portRemoved (const juce::String& name);
+	//after the socket or the inotify queue has lost events, works out what changed from the enumerator's list
+	void resync();
+	int findKnownPort (const juce::String& name) const;
+
+	Listener& listener;
+	SerialPortEnumerator& enumerator;
+	//held while the list of ports is changed and the listener told, so events from the thread and handleUevent() take turns
+	juce::CriticalSection lock;
+	juce::Array<SerialPortInfo> knownPorts;
+	int netlinkDescriptor = -1;
+	int inotifyDescriptor = -1;
+	int devWatch = -1, ptsWatch = -1;
+	SerialPortWakeup wakeup;
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortMonitor)
+};
+#endif
+
+//////////////////////////////////////////////////////////////////
+//byte queue with a fixed, power-of-two capacity, used between the stream threads and their callers.
+//one thread may write to it while one other thread reads from it, without either of them taking a lock.
+//the writer may also throw away the oldest data with discard(), as long as the reader only ever uses skipFrom()
+class JUCE_API SerialPortRingBuffer
+{
+public:
+	explicit SerialPortRingBuffer (size_t minimumCapacity)
+	{
+		capacity = 1;
+		while (capacity < minimumCapacity)
+			capacity <<= 1;
+		mask = capacity - 1;
+		data.malloc (capacity);
+	}
+
+	size_t getCapacity() const { return capacity; }
+	//the read position is loaded first. It can move on after that, but never past a write position loaded later
+	size_t getNumReady() const
+	{
+		const auto position = readPosition.load (std::memory_order_acquire);
+		return writePosition.load (std::memory_order_acquire) - position;
+	}
+	size_t getFreeSpace() const { return capacity - getNumReady(); }
+	//running totals of the bytes written and read, which never wrap in practice, so they can be used to mark a place in the stream
+	size_t getWritePosition() const { return writePosition.load (std::memory_order_acquire); }
+	size_t getReadPosition() const { return readPosition.load (std::memory_order_acquire); }
+
+	//writer side. copies in as much as there is room for, and returns how much that was
+	size_t write (const void* source, size_t numBytes)
+	{
+		const auto position = writePosition.load (std::memory_order_relaxed);
+		numBytes = std::min (numBytes, capacity - (position - readPosition.load (std::memory_order_acquire)));
+		const auto start = position & mask;
+		const auto firstPart = std::min (numBytes, capacity - start);
+		memcpy (data + start, source, firstPart);
+		memcpy (data, static_cast<const uint8_t*> (source) + firstPart, numBytes - firstPart);
+		writePosition.store (position + numBytes, std::memory_order_release);
+		return numBytes;
+	}
+
+	//reader side. copies out up to numBytes without removing them, starting offset bytes in
+	size_t peek (void* dest, size_t numBytes, size_t offset = 0) const
+	{
+		const auto position = readPosition.load (std::memory_order_relaxed);
+		const auto available = writePosition.load (std::memory_order_acquire) - position;
+		if (offset >= available)
+			return 0;
+		numBytes = std::min (numBytes, available - offset);
+		const auto start = (position + offset) & mask;
+		const auto firstPart = std::min (numBytes, capacity - start);
+		memcpy (dest, data + start, firstPart);
+		memcpy (static_cast<uint8_t*> (dest) + firstPart, data, numBytes - firstPart);
+		return numBytes;
+	}
+
+	//reader side. discards up to numBytes, returning how many were removed
+	size_t skip (size_t numBytes)
+	{
+		const auto position = readPosition.load (std::memory_order_relaxed);
+		numBytes = std::min (numBytes, writePosition.load (std::memory_order_acquire) - position);
+		readPosition.store (position + numBytes, std::memory_order_release);
+		return numBytes;
+	}
+
+	//reader side, for when the writer may discard(). removes numBytes if the read position is still position, and returns
+	//false if it isn't, in which case anything looked at from there may have been overwritten, and has to be looked at again
+	bool skipFrom (size_t position, size_t numBytes)
+	{
+		return readPosition.compare_exchange_strong (position, position + numBytes, std::memory_order_acq_rel);
+	}
+
+	//writer side. throws away up to numBytes of the oldest data to make room, returning how many went
+	size_t discard (size_t numBytes)
+	{
+		auto position = readPosition.load (std::memory_order_acquire);
+		for (;;)
+		{
+			const auto numDiscarded = std::min (numBytes, writePosition.load (std::memory_order_relaxed) - position);
+			if (readPosition.compare_exchange_weak (position, position + numDiscarded, std::memory_order_acq_rel))
+				return numDiscarded;
+		}
+	}
+
+	//reader side
+	size_t read (void* dest, size_t numBytes)
+	{
+		return skip (peek (dest, numBytes));
+	}
+
+	//reader side. the bytes that are ready, as up to two contiguous regions, so they can be used in place
+	void getReadRegions (const uint8_t*& block1, size_t& size1, const uint8_t*& block2, size_t& size2) const
+	{
+		const auto position = readPosition.load (std::memory_order_relaxed);
+		const auto available = writePosition.load (std::memory_order_acquire) - position;
+		const auto start = position & mask;
+		block1 = data + start;
+		size1 = std::min (available, capacity - start);
+		block2 = data;
+		size2 = available - size1;
+	}
+
+private:
+	juce::HeapBlock<uint8_t> data;
+	size_t capacity;
+	size_t mask;
+	//kept on separate cache lines, as each one is written by a different thread
+	alignas (64) std::atomic<size_t> readPosition { 0 };
+	alignas (64) std::atomic<size_t> writePosition { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortRingBuffer)
+};
+
+#if JUCE_LINUX
+class SerialPortInputStream;
+class SerialPortOutputStream;
+
+//////////////////////////////////////////////////////////////////
+//services the reads and writes of any number of ports from one epoll thread, instead of each stream running a thread
+//of its own. A stream is attached by passing the reactor to its constructor, and must be destroyed before the reactor.
+//to spread a large number of ports over a few threads, create a few reactors and share the ports out between them
+class JUCE_API SerialPortReactor : private juce::Thread
+{
+public:
+	SerialPortReactor (const juce::String& threadName = "SerialReactorThread");
+	~SerialPortReactor();
+	//how many ports currently have a stream attached
+	int getNumPorts() const;
+	void setReactorPriority (int priority) { setPriority (priority); }
+	void run() override;
+
+	//one per attached port, shared by its input and output streams
+	struct Registration;
+
+private:
+	friend class SerialPortInputStream;
+	friend class SerialPortOutputStream;
+	Registration* attach (SerialPort* port, SerialPortInputStream* input, SerialPortOutputStream* output);
+	void detach (Registration* registration, bool input);
+	//called from any thread to start or stop watching the port for reading or writing
+	void setInterest (Registration* registration, bool input, bool enabled);
+	//both return false when they left the port alone
+	bool serviceInput (Registration& registration);
+	bool serviceOutput (Registration& registration);
+	void portFailed (Registration& registration, const juce::String& method, const juce::String& message);
+	//sends the change messages held back by input streams that have gone quiet, and returns the epoll_wait() timeout
+	//needed for the rest
+	int sendIdleNotifications();
+
+	int epollDescriptor;
+	SerialPortWakeup wakeup;
+	juce::CriticalSection lock;
+	juce::OwnedArray<Registration> registrations;
+	//detached registrations are only deleted once the thread is back in epoll_wait, as a batch of events it already holds may still refer to them
+	juce::OwnedArray<Registration> retired;
+	juce::Array<Registration*> pendingNotifications;
+	juce::HeapBlock<uint8_t> chunk;
+	size_t chunkSize;
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortReactor)
+};
+#endif
+
 //////////////////////////////////////////////////////////////////
 class JUCE_API SerialPortInputStream : public juce::InputStream, public juce::ChangeBroadcaster, private juce::Thread
 {
 public:
-    SerialPortInputStream(SerialPort * port) :
-		Thread("SerialInThread"), port(port),bufferedbytes(0), notify(NOTIFY_OFF), notifyChar(0)
+	//bufferSize is how many received bytes can be held waiting to be read. It is rounded up to a power of two,
+	//and what happens when it is full is up to setOverflowPolicy()
+    SerialPortInputStream(SerialPort * port, size_t bufferSize = defaultBufferSize) :
+		Thread("SerialInThread"), port(port), buffer(bufferSize), notify(NOTIFY_OFF), notifyChar(0), readChunkSize(4096), readerWaitingForRoom(false)
+	{
+		jassert (port != nullptr);
+		//the far end of a virtual pair hands its data over itself
+		if (port != nullptr && port->isVirtual())
+			attachToVirtualPair();
+		else
+			startThread();
+	}
+#if JUCE_LINUX
+	//serviced by the reactor instead of a reader thread of its own
+    SerialPortInputStream(SerialPort * port, SerialPortReactor& reactorToUse, size_t bufferSize = defaultBufferSize) :
+		Thread("SerialInThread"), port(port), buffer(bufferSize), notify(NOTIFY_OFF), notifyChar(0), readChunkSize(4096), readerWaitingForRoom(false)
 	{
-		startThread();
+		jassert (port != nullptr);
+		reactor = &reactorToUse;
+		registration = reactor->attach (port, this, nullptr);
 	}
+#endif
 
 	virtual ~SerialPortInputStream()
 	{
+	#if JUCE_LINUX
+		if (reactor != nullptr)
+			reactor->detach (registration, true);
+	#endif
 		signalThreadShouldExit();
         cancel ();
+		roomAvailable.signal();
+		dataAvailable.signal();
+		if (port != nullptr && port->isVirtual())
+			detachFromVirtualPair();
         waitForThreadToExit (5000);
 	}
 
@@ -167,48 +741,229 @@ public:
 		this->notify = _notify;
 	}
 
+	//limits how often the change messages asked for by setNotify() are sent. Received data is always checked once per
+	//chunk, and a change message is held back until minBytes have arrived or minIntervalMicroseconds have passed since
+	//the last one, whichever comes first. One that is still held back when the data stops is sent minIntervalMicroseconds
+	//after the previous one, or straight away if there is no interval, so the end of a burst is never missed.
+	//the default of 0, 0 sends one for every chunk that asks for it
+	struct NotifyPolicy
+	{
+		int minBytes = 0;
+		int minIntervalMicroseconds = 0;
+	};
+	void setNotifyPolicy (const NotifyPolicy& policy)
+	{
+		notifyMinBytes = juce::jmax (0, policy.minBytes);
+		notifyMinInterval = juce::jmax (0, policy.minIntervalMicroseconds);
+	}
+	NotifyPolicy getNotifyPolicy() const
+	{
+		NotifyPolicy policy;
+		policy.minBytes = notifyMinBytes;
+		policy.minIntervalMicroseconds = notifyMinInterval;
+		return policy;
+	}
+
+	//receives data on the thread that reads it from the port (the reader thread, or the reactor), as soon as each chunk
+	//arrives, without going through the message thread. data is only valid during the call, so the callback should be quick
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		//receivedNanos is when the read that took the chunk from the driver returned, from getTimestampNanos(), the same
+		//clock as the receive times readWithTimestamps() gives
+		virtual void serialDataReceived (SerialPortInputStream& stream, const uint8_t* data, size_t numBytes, juce::int64 receivedNanos) = 0;
+	};
+	//one listener at a time, nullptr to remove it. If alsoAddToBuffer is false the chunks go only to the listener, so
+	//read() and the change messages see nothing. Once this returns, the previous listener won't be called again
+	void setListener (Listener* newListener, bool alsoAddToBuffer = true)
+	{
+		const juce::ScopedLock sl (listenerLock);
+		listenerAlsoBuffers = alsoAddToBuffer;
+		listener = newListener;
+	}
+
+	//what happens when data arrives and the buffer is full. OVERFLOW_BLOCK, the default, stops taking data from the driver
+	//until some has been read, so nothing is lost here. The driver's own buffer fills next, and once it is full a port
+	//with hardware or XON/XOFF flow control set holds the sender off (by dropping RTS or sending XOFF), and one without
+	//loses data in the driver. OVERFLOW_DROP_NEWEST throws away what doesn't fit, and OVERFLOW_DROP_OLDEST throws away the
+	//oldest unread data to make room for it, so the receiving side always keeps up with the port
+	enum overflowpolicy{OVERFLOW_BLOCK=0, OVERFLOW_DROP_NEWEST, OVERFLOW_DROP_OLDEST};
+	void setOverflowPolicy (overflowpolicy policy)
+	{
+		overflowPolicy = policy;
+	#if JUCE_LINUX
+		//the reactor may have stopped watching the port while it waited for room
+		if (reactor != nullptr && policy != OVERFLOW_BLOCK && readerWaitingForRoom.exchange (false))
+			reactor->setInterest (registration, true, true);
+	#endif
+		roomAvailable.signal();
+	}
+	//how many received bytes the overflow policy has thrown away
+	juce::uint64 getNumBytesDropped() const { return numBytesDropped; }
+	//how many times data has arrived to find the buffer full, whatever the policy
+	juce::uint64 getNumOverflows() const { return numOverflows; }
+
+	//what ends a line for canReadLine(), readNextLine() and readLine(). LINE_CRLF ends a line at '\n' and drops a '\r' just
+	//before it, LINE_ANY_OF ends one at any of the (up to 32) bytes in delimiters. The default is LINE_LF. The receiving thread
+	//indexes lines as the data arrives, so this should be set before the data it applies to
+	enum lineending{LINE_LF=0, LINE_CRLF, LINE_CR, LINE_NUL, LINE_ANY_OF};
+	void setLineEnding (lineending ending = LINE_LF, const char* delimiters = nullptr)
+	{
+		LineFormat format;
+		format.stripCarriageReturn = ending == LINE_CRLF;
+		format.numDelimiters = 1;
+		switch (ending)
+		{
+			case LINE_LF:
+			case LINE_CRLF:   format.delimiters[0] = '\n'; break;
+			case LINE_CR:     format.delimiters[0] = '\r'; break;
+			case LINE_NUL:    format.delimiters[0] = 0; break;
+			case LINE_ANY_OF:
+				jassert (delimiters != nullptr && strlen (delimiters) <= sizeof (format.delimiters));
+				format.numDelimiters = delimiters != nullptr ? (int) juce::jmin (strlen (delimiters), sizeof (format.delimiters)) : 0;
+				memcpy (format.delimiters, delimiters, (size_t) format.numDelimiters);
+				break;
+		}
+		const juce::SpinLock::ScopedLockType sl (lineFormatLock);
+		lineFormat = format;
+	}
+
+	//a line that reaches this many bytes without a delimiter is handed out in pieces of this size, so a device that never
+	//sends one can't fill the buffer. 0, the default, means no limit
+	void setMaxLineLength (size_t numBytes)
+	{
+		maxLineLength = numBytes;
+		lineScratch.ensureSize (numBytes);
+	}
+
+	//constant time, as the receiving thread keeps track of the last delimiter it has added to the buffer
 	bool canReadString()
 	{
-		const juce::ScopedLock l (bufferCriticalSection);
-		int iNdx=0;
-		while (iNdx < bufferedbytes)
-			if(buffer[iNdx++]==0)return true;
-		return false;
+		return lastNulEnd.load (std::memory_order_acquire) > buffer.getReadPosition();
 	}
 
 	bool canReadLine()
 	{
-		const juce::ScopedLock l (bufferCriticalSection);
-		int iNdx=0;
-		while (iNdx < bufferedbytes)
-			if (buffer[iNdx++]=='\n' /*|| (buffer[iNdx++]=='\r')*/)
+		const size_t maxLength = maxLineLength;
+		return lastLineEnd.load (std::memory_order_acquire) > buffer.getReadPosition()
+			|| (maxLength > 0 && buffer.getNumReady() >= maxLength);
+	}
+
+	//these read a line without allocating anything, once setMaxLineLength() has sized the internal buffer. They return false
+	//if there isn't a whole line yet, and leave the delimiter out. The first copies the line into dest, handing out a longer one
+	//in pieces of destSize. The second hands out a view of it which stays valid until the next readLine()
+	bool readLine (char* dest, size_t destSize, size_t& lineLength)
+	{
+		size_t delimiterLength;
+		const size_t maxLength = maxLineLength;
+		for (;;)
+		{
+			const auto position = buffer.getReadPosition();
+			if (destSize == 0 || ! findLine (maxLength > 0 ? juce::jmin (maxLength, destSize) : destSize, lineLength, delimiterLength))
+				return false;
+			buffer.peek (dest, lineLength);
+			if (removeFromBuffer (position, lineLength + delimiterLength))
 				return true;
-		return false;
+		}
+	}
+
+	bool readLine (std::string_view& line)
+	{
+		size_t lineLength, delimiterLength;
+		for (;;)
+		{
+			const auto position = buffer.getReadPosition();
+			if (! findLine (maxLineLength, lineLength, delimiterLength))
+				return false;
+			lineScratch.ensureSize (lineLength);
+			buffer.peek (lineScratch.getData(), lineLength);
+			if (removeFromBuffer (position, lineLength + delimiterLength))
+				break;
+		}
+		line = std::string_view (static_cast<const char*> (lineScratch.getData()), lineLength);
+		return true;
+	}
+
+	//these block the caller until data arrives, rather than it polling isExhausted(). timeoutMs is the most they wait
+	//altogether, -1 being forever, and they give up early if the port stops. waitForData() returns true once there
+	//is something to read. readAtLeast() reads as the data arrives until it has minBytes, then takes whatever else is
+	//ready up to maxBytes. It returns how many it read, which is short if it timed out, or -1 if the port was closed
+	//before it could read anything. readExactly() is readAtLeast() with minBytes and maxBytes the same
+	bool waitForData (int timeoutMs = -1)
+	{
+		return waitForDataUntil (deadlineFor (timeoutMs));
+	}
+
+	int readAtLeast (void* destBuffer, int minBytes, int maxBytes, int timeoutMs = -1)
+	{
+		jassert (minBytes <= maxBytes);
+		const auto deadline = deadlineFor (timeoutMs);
+		auto* dest = static_cast<uint8_t*> (destBuffer);
+		int total = 0;
+		for (;;)
+		{
+			const auto numRead = read (dest + total, maxBytes - total);
+			if (numRead < 0)
+				return total > 0 ? total : -1;
+			total += numRead;
+			if (total >= minBytes || ! waitForDataUntil (deadline))
+				return total;
+		}
+	}
+
+	int readExactly (void* destBuffer, int numBytes, int timeoutMs = -1)
+	{
+		return readAtLeast (destBuffer, numBytes, numBytes, timeoutMs);
 	}
 
 	virtual void run();
 	virtual int read(void *destBuffer, int maxBytesToRead);
 	virtual juce::String readNextLine() //have to override this, because InputStream::readNextLine isn't compatible with SerialPorts (uses setPos)
 	{
-		juce::String s;
-		char c;
-		s.preallocateBytes(32);
-		while(read(&c, 1) && (c!='\n'))
-			s.append(juce::String::charToString(c), 1);
-		s = s.trim();
-		return s;
+		//takes everything up to the next line ending, or everything there is if there isn't one, and trims it. The String is made
+		//straight from the buffer, unless the line wraps around the end of it
+		for (;;)
+		{
+			const auto position = buffer.getReadPosition();
+			size_t lineLength, delimiterLength;
+			const bool found = findLine (maxLineLength, lineLength, delimiterLength);
+			const uint8_t* block1;
+			const uint8_t* block2;
+			size_t size1, size2;
+			buffer.getReadRegions (block1, size1, block2, size2);
+			if (! found)
+			{
+				lineLength = size1 + size2;
+				delimiterLength = 0;
+			}
+			const uint8_t* line = block1;
+			if (lineLength > size1)
+			{
+				lineScratch.ensureSize (lineLength);
+				buffer.peek (lineScratch.getData(), lineLength);
+				line = static_cast<const uint8_t*> (lineScratch.getData());
+			}
+			size_t start = 0;
+			size_t end = lineLength;
+			while (start < end && line[start] <= ' ')
+				++start;
+			while (end > start && line[end - 1] <= ' ')
+				--end;
+			juce::String s (juce::String::fromUTF8 (reinterpret_cast<const char*> (line + start), (int) (end - start)));
+			if (removeFromBuffer (position, lineLength + delimiterLength))
+				return s;
+		}
 	}
 
 	virtual juce::int64 getTotalLength()
 	{
-		const juce::ScopedLock l(bufferCriticalSection);
-		return bufferedbytes;
+		return (juce::int64) buffer.getNumReady();
 	};
 
 	virtual bool isExhausted()
 	{
-		const juce::ScopedLock l(bufferCriticalSection);
-		return bufferedbytes ? false : true;
+		return buffer.getNumReady() == 0;
 	};
 
 	virtual juce::int64 getPosition(){return 0;}
@@ -216,14 +971,468 @@ public:
     virtual void cancel ();
     SerialPort* getPort() { return port; }
     void setReaderPriority (int priority) { setPriority (priority); }
+	//the reader thread takes up to this many bytes from the driver in each read, the default is 4096
+	void setReadChunkSize (int numBytes) { readChunkSize = juce::jmax (1, numBytes); }
+	int getReadChunkSize () const { return readChunkSize; }
+
+	//the clock the receive times come from, in nanoseconds. CLOCK_MONOTONIC_RAW on Linux, Android and the Mac, so NTP
+	//slewing doesn't stretch the gaps between them, and the performance counter on Windows
+	static juce::int64 getTimestampNanos();
+
+	//where in the data a read chunk starts, and when the receiving side took it from the driver
+	struct ReceiveTime
+	{
+		size_t offset;
+		juce::int64 timestampNanos;
+	};
+	//reads like read(), and also fills times with one entry for each chunk the data came in, in order. The first always
+	//has an offset of 0, as it is the chunk the first byte came in. If there are more chunks than maxTimes the read stops
+	//short at the start of the next one, so every byte has a time. The times of up to 1024 chunks that haven't been read
+	//are kept, and while that many are waiting, any more get the time of the last one kept
+	int readWithTimestamps (void* destBuffer, int maxBytesToRead, ReceiveTime* times, int maxTimes, int& numTimes)
+	{
+		jassert (maxTimes > 0);
+		for (;;)
+		{
+			numTimes = 0;
+			const auto position = buffer.getReadPosition();
+			auto numBytes = juce::jmin (buffer.getNumReady(), (size_t) juce::jmax (0, maxBytesToRead));
+			const auto numWritten = numTimesWritten.load (std::memory_order_acquire);
+			for (auto i = timesReadIndex.load (std::memory_order_relaxed); i < numWritten; ++i)
+			{
+				const auto& record = receiveTimes[i & receiveTimesMask];
+				if (record.position >= position + numBytes)
+					break;
+				const auto offset = record.position > position ? record.position - position : 0;
+				//a chunk that was dropped entirely is replaced by the one after it
+				if (numTimes > 0 && times[numTimes - 1].offset == offset)
+					--numTimes;
+				else if (numTimes == maxTimes)
+				{
+					numBytes = offset;
+					break;
+				}
+				times[numTimes++] = { offset, record.timestampNanos };
+			}
+			const auto numRead = buffer.peek (destBuffer, numBytes);
+			if (removeFromBuffer (position, numRead))
+				return (int) numRead;
+		}
+	}
+
+	static const size_t defaultBufferSize = 1 << 18;
 
 private:
+	//called by the reader thread with each chunk it receives, and the time it came back from the driver.
+	//If the buffer is full this waits for the caller to read some of it
+	void addToBuffer (const void* data, int numBytes, juce::int64 receivedNanos = getTimestampNanos())
+	{
+		countReceived (numBytes);
+		if (deliverToListener (data, numBytes, receivedNanos))
+			return;
+		recordReceiveTime (receivedNanos);
+		auto* source = static_cast<const uint8_t*> (data);
+		auto remaining = (size_t) numBytes;
+		while (remaining > 0 && ! threadShouldExit())
+		{
+			const auto stored = storeChunk (source, remaining);
+			chunkAdded (source, (int) stored);
+			source += stored;
+			remaining -= stored;
+			if (remaining > 0)
+			{
+				//a caller that only reads when it's told to would never make the room, so anything held back goes first
+				flushNotification();
+				readerWaitingForRoom = true;
+				std::atomic_thread_fence (std::memory_order_seq_cst);
+				if (buffer.getFreeSpace() == 0 && overflowPolicy == OVERFLOW_BLOCK)
+					roomAvailable.wait();
+				readerWaitingForRoom = false;
+			}
+		}
+	}
+
+	//called by the receiving side just before it adds a chunk, so a time is always there before its bytes are. If the caller
+	//has fallen so far behind that there's no room to remember it, its bytes get the time of the chunk before
+	void recordReceiveTime (juce::int64 receivedNanos)
+	{
+		const auto index = numTimesWritten.load (std::memory_order_relaxed);
+		if (index - timesReadIndex.load (std::memory_order_acquire) >= numReceiveTimes)
+			return;
+		receiveTimes[index & receiveTimesMask] = { buffer.getWritePosition(), receivedNanos };
+		numTimesWritten.store (index + 1, std::memory_order_release);
+	}
+
+	//the caller's side. counts how long each chunk that has now been read to the end waited, and lets go of the times
+	//of the chunks that have been read, keeping the one the next byte is in
+	void forgetReceiveTimes (size_t readPosition)
+	{
+		const auto numWritten = numTimesWritten.load (std::memory_order_acquire);
+		juce::int64 now = 0;
+		while (timesCountedIndex < numWritten)
+		{
+			const auto end = timesCountedIndex + 1 < numWritten ? receiveTimes[(timesCountedIndex + 1) & receiveTimesMask].position
+			                                                    : buffer.getWritePosition();
+			if (end > readPosition)
+				break;
+			if (now == 0)
+				now = getTimestampNanos();
+			port->statistics.readLatency.record (now - receiveTimes[timesCountedIndex & receiveTimesMask].timestampNanos);
+			++timesCountedIndex;
+		}
+		auto index = timesReadIndex.load (std::memory_order_relaxed);
+		while (index + 1 < numWritten && receiveTimes[(index + 1) & receiveTimesMask].position <= readPosition)
+			++index;
+		timesReadIndex.store (index, std::memory_order_release);
+	}
+
+	void countReceived (int numBytes)
+	{
+		SerialPortStatistics::add (port->statistics.chunksIn, 1);
+		SerialPortStatistics::add (port->statistics.bytesIn, (juce::uint64) numBytes);
+	}
+
+	void dropped (size_t numBytes)
+	{
+		numBytesDropped += numBytes;
+		SerialPortStatistics::add (port->statistics.bytesDroppedIn, numBytes);
+	}
+
+	//adds a chunk, applying the overflow policy to whatever doesn't fit. returns how many bytes it has dealt with, which
+	//is less than numBytes only with OVERFLOW_BLOCK, when the rest has to wait for room
+	size_t storeChunk (const uint8_t* source, size_t numBytes)
+	{
+		const overflowpolicy policy = overflowPolicy;
+		size_t numDealtWith = 0;
+		if (policy == OVERFLOW_DROP_OLDEST && numBytes > buffer.getCapacity())
+		{
+			//only the newest bytes fit, whatever is thrown away
+			numDealtWith = numBytes - buffer.getCapacity();
+			dropped (numDealtWith);
+		}
+		numDealtWith += writeToBuffer (source + numDealtWith, numBytes - numDealtWith);
+		if (numDealtWith == numBytes && numBytes <= buffer.getCapacity())
+			return numBytes;
+		++numOverflows;
+		if (policy == OVERFLOW_DROP_NEWEST)
+		{
+			dropped (numBytes - numDealtWith);
+			return numBytes;
+		}
+		//the caller may be reading at the same time, in which case this only has to go round again
+		while (policy == OVERFLOW_DROP_OLDEST && numDealtWith < numBytes)
+		{
+			const auto remaining = numBytes - numDealtWith;
+			const auto freeSpace = buffer.getFreeSpace();
+			if (remaining > freeSpace)
+				dropped (buffer.discard (remaining - freeSpace));
+			numDealtWith += writeToBuffer (source + numDealtWith, remaining);
+		}
+		return numDealtWith;
+	}
+
+	//adds as much as there is room for, and notes where the last of each delimiter in it ended up.
+	//only the new bytes are scanned, so the delimiter checks never have to look through the whole backlog
+	size_t writeToBuffer (const uint8_t* source, size_t numBytes)
+	{
+		const auto position = buffer.getWritePosition();
+		const auto written = buffer.write (source, numBytes);
+		SerialPortStatistics::noteQueueSize (port->statistics.inputQueueHighWater, buffer.getNumReady());
+		size_t lineEnd = 0;
+		{
+			const juce::SpinLock::ScopedLockType sl (lineFormatLock);
+			for (int i = 0; i < lineFormat.numDelimiters; ++i)
+				lineEnd = juce::jmax (lineEnd, findLast (source, written, lineFormat.delimiters[i]));
+		}
+		if (lineEnd > 0)
+			lastLineEnd.store (position + lineEnd, std::memory_order_release);
+		if (const auto nul = findLast (source, written, 0))
+			lastNulEnd.store (position + nul, std::memory_order_release);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (written > 0 && callerWaitingForData)
+			dataAvailable.signal();
+		return written;
+	}
+
+	//the Time::getMillisecondCounterHiRes() by which a wait of timeoutMs is over, or -1 for one with no timeout
+	static double deadlineFor (int timeoutMs)
+	{
+		return timeoutMs < 0 ? -1.0 : juce::Time::getMillisecondCounterHiRes() + timeoutMs;
+	}
+
+	//the caller's side of the handshake with writeToBuffer(). callerWaitingForData is raised before the buffer is
+	//checked, so data that lands in between still signals, and stoppedServicing() signals whether anyone is waiting
+	bool waitForDataUntil (double deadline)
+	{
+		while (buffer.getNumReady() == 0)
+		{
+			int timeoutMs = -1;
+			if (deadline >= 0)
+			{
+				timeoutMs = (int) std::ceil (deadline - juce::Time::getMillisecondCounterHiRes());
+				if (timeoutMs <= 0)
+					return false;
+			}
+			if (! isBeingServiced())
+				return false;
+			callerWaitingForData = true;
+			std::atomic_thread_fence (std::memory_order_seq_cst);
+			if (buffer.getNumReady() == 0)
+				dataAvailable.wait (timeoutMs);
+			callerWaitingForData = false;
+		}
+		return true;
+	}
+
+	bool isBeingServiced()
+	{
+		if (port != nullptr && port->isVirtual())
+			return true;
+		if (serviceStopped)
+			return false;
+	#if JUCE_LINUX
+		if (reactor != nullptr)
+			return port->portDescriptor != -1;
+	#endif
+		return isThreadRunning();
+	}
+
+	//called by the reader thread as it leaves run(), or by the reactor when the port fails. It goes after whatever
+	//isBeingServiced() looks at, so a caller that checked too soon still wakes up and sees it
+	void stoppedServicing()
+	{
+		serviceStopped = true;
+		dataAvailable.signal();
+	}
+
+	//finds the next line in the buffer. A line ending more than maxLength bytes in is cut at maxLength, with no delimiter
+	//to skip. returns false if there isn't a whole line
+	bool findLine (size_t maxLength, size_t& lineLength, size_t& delimiterLength)
+	{
+		const uint8_t* block1;
+		const uint8_t* block2;
+		size_t size1, size2;
+		buffer.getReadRegions (block1, size1, block2, size2);
+		const auto available = size1 + size2;
+		LineFormat format;
+		{
+			const juce::SpinLock::ScopedLockType sl (lineFormatLock);
+			format = lineFormat;
+		}
+		//the delimiter, and the '\r' before it, may be just past the maximum length
+		const auto limit = maxLength > 0 ? juce::jmin (maxLength + (format.stripCarriageReturn ? 2 : 1), available) : available;
+		auto position = limit;
+		if (lastLineEnd.load (std::memory_order_acquire) > buffer.getReadPosition())
+			for (int i = 0; i < format.numDelimiters; ++i)
+				position = findFirst (block1, size1, block2, size2, format.delimiters[i], position);
+		if (position < limit)
+		{
+			lineLength = position;
+			delimiterLength = 1;
+			if (format.stripCarriageReturn && position > 0 && (position <= size1 ? block1[position - 1] : block2[position - 1 - size1]) == '\r')
+			{
+				--lineLength;
+				++delimiterLength;
+			}
+			if (maxLength == 0 || lineLength <= maxLength)
+				return true;
+		}
+		if (maxLength > 0 && available >= maxLength)
+		{
+			lineLength = maxLength;
+			delimiterLength = 0;
+			return true;
+		}
+		return false;
+	}
+
+	//the offset of the first occurrence of value in the two regions, searching no further than limit bytes, or limit if there isn't one
+	static size_t findFirst (const uint8_t* block1, size_t size1, const uint8_t* block2, size_t size2, uint8_t value, size_t limit)
+	{
+		if (auto* found = static_cast<const uint8_t*> (memchr (block1, value, juce::jmin (size1, limit))))
+			return (size_t) (found - block1);
+		if (limit > size1)
+			if (auto* found = static_cast<const uint8_t*> (memchr (block2, value, juce::jmin (size2, limit - size1))))
+				return size1 + (size_t) (found - block2);
+		return limit;
+	}
+
+	//the offset just past the last occurrence of value, or 0 if there isn't one
+	static size_t findLast (const uint8_t* data, size_t numBytes, uint8_t value)
+	{
+		size_t end = 0;
+		for (auto* p = data; auto* found = static_cast<const uint8_t*> (memchr (p, value, numBytes - (size_t) (p - data)));)
+		{
+			p = found + 1;
+			end = (size_t) (p - data);
+		}
+		return end;
+	}
+
+	//passes a chunk to the listener, if there is one. returns true if it has taken the chunk in place of the buffer
+	bool deliverToListener (const void* data, int numBytes, juce::int64 receivedNanos)
+	{
+		if (listener == nullptr)
+			return false;
+		const juce::ScopedLock sl (listenerLock);
+		if (listener == nullptr)
+			return false;
+		listener.load()->serialDataReceived (*this, static_cast<const uint8_t*> (data), (size_t) numBytes, receivedNanos);
+		return ! listenerAlsoBuffers;
+	}
+
+	//called once for each chunk that has been added to the buffer, by whichever thread received it
+	void chunkAdded (const void* data, int numBytes)
+	{
+		bytesSinceNotification += numBytes;
+		if (notify == NOTIFY_ALWAYS || (notify == NOTIFY_ON_CHAR && memchr (data, notifyChar, (size_t) numBytes) != nullptr))
+			notificationPending = true;
+		if (! notificationPending)
+			return;
+		const int minBytes = notifyMinBytes;
+		const int minInterval = notifyMinInterval;
+		if ((minBytes == 0 && minInterval == 0)
+			|| (minBytes > 0 && bytesSinceNotification >= minBytes)
+			|| (minInterval > 0 && juce::Time::getHighResolutionTicks() >= notificationDueTicks (minInterval)))
+			sendNotification();
+	}
+
+	//called by the receiving thread when the driver has nothing more for it. Sends a held back change message that is due,
+	//and returns how many milliseconds until the one still held back will be, or -1 if there isn't one
+	int sendIdleNotification()
+	{
+		if (! notificationPending)
+			return -1;
+		const int minInterval = notifyMinInterval;
+		if (minInterval > 0)
+		{
+			const auto remaining = notificationDueTicks (minInterval) - juce::Time::getHighResolutionTicks();
+			if (remaining > 0)
+				return (int) ((remaining * 1000 + juce::Time::getHighResolutionTicksPerSecond() - 1) / juce::Time::getHighResolutionTicksPerSecond());
+		}
+		sendNotification();
+		return -1;
+	}
+
+	juce::int64 notificationDueTicks (int minInterval) const
+	{
+		return lastNotificationTicks + minInterval * juce::Time::getHighResolutionTicksPerSecond() / 1000000;
+	}
+
+	void attachToVirtualPair();
+	void detachFromVirtualPair();
+
+	//sends a held back change message now, whatever the rate limits say
+	void flushNotification()
+	{
+		if (notificationPending)
+			sendNotification();
+	}
+
+	void sendNotification()
+	{
+		notificationPending = false;
+		bytesSinceNotification = 0;
+		lastNotificationTicks = juce::Time::getHighResolutionTicks();
+		sendChangeMessage();
+	}
+
+	//called by read(), without any locking as the reader thread only ever adds to the buffer, or with OVERFLOW_DROP_OLDEST
+	//moves the read position on, which removeFromBuffer() notices
+	int readFromBuffer (void* destBuffer, int maxBytesToRead)
+	{
+		for (;;)
+		{
+			const auto position = buffer.getReadPosition();
+			const auto numRead = buffer.peek (destBuffer, (size_t) juce::jmax (0, maxBytesToRead));
+			if (removeFromBuffer (position, numRead))
+				return (int) numRead;
+		}
+	}
+
+	//the caller's side. discards bytes that have been read from position on, and lets the receiving side carry on if it
+	//was waiting for room. returns false, removing nothing, if the receiving side has dropped some of them in the meantime
+	bool removeFromBuffer (size_t position, size_t numBytes)
+	{
+		if (! buffer.skipFrom (position, numBytes))
+			return false;
+		forgetReceiveTimes (position + numBytes);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (readerWaitingForRoom)
+		{
+		#if JUCE_LINUX
+			if (reactor != nullptr)
+			{
+				readerWaitingForRoom = false;
+				reactor->setInterest (registration, true, true);
+				return true;
+			}
+		#endif
+			roomAvailable.signal();
+		}
+		return true;
+	}
+
 	SerialPort* port;
-	int bufferedbytes;
-	juce::MemoryBlock buffer;
-	juce::CriticalSection bufferCriticalSection;
+	SerialPortRingBuffer buffer;
 	notifyflag notify;
 	char notifyChar;
+	std::atomic<int> readChunkSize;
+	struct LineFormat
+	{
+		uint8_t delimiters[32] = { '\n' };
+		int numDelimiters = 1;
+		bool stripCarriageReturn = false;
+	};
+	LineFormat lineFormat;
+	juce::SpinLock lineFormatLock;
+	std::atomic<size_t> maxLineLength { 0 };
+	//the buffer positions just past the last line ending and 0 that were added to it
+	std::atomic<size_t> lastLineEnd { 0 };
+	std::atomic<size_t> lastNulEnd { 0 };
+	//used by the line readers when the line has to be copied out of the buffer
+	juce::MemoryBlock lineScratch;
+	std::atomic<int> notifyMinBytes { 0 };
+	std::atomic<int> notifyMinInterval { 0 };
+	//only used by the receiving thread
+	bool notificationPending = false;
+	int bytesSinceNotification = 0;
+	juce::int64 lastNotificationTicks = 0;
+	std::atomic<bool> readerWaitingForRoom;
+	juce::WaitableEvent roomAvailable;
+	std::atomic<overflowpolicy> overflowPolicy { OVERFLOW_BLOCK };
+	std::atomic<juce::uint64> numBytesDropped { 0 };
+	std::atomic<juce::uint64> numOverflows { 0 };
+	//the buffer position each chunk that hasn't been read yet started at, and when it was received. Written by the
+	//receiving side, and let go of by the caller's side as it reads
+	struct ReceiveRecord
+	{
+		size_t position;
+		juce::int64 timestampNanos;
+	};
+	static const size_t numReceiveTimes = 1024;
+	static const size_t receiveTimesMask = numReceiveTimes - 1;
+	ReceiveRecord receiveTimes[numReceiveTimes];
+	std::atomic<size_t> numTimesWritten { 0 };
+	std::atomic<size_t> timesReadIndex { 0 };
+	//only used by the caller's side, the first chunk that hasn't been read to the end
+	size_t timesCountedIndex = 0;
+	std::atomic<bool> callerWaitingForData { false };
+	juce::WaitableEvent dataAvailable;
+	std::atomic<bool> serviceStopped { false };
+	//held while the listener is called, so setListener() can't return part way through a call
+	juce::CriticalSection listenerLock;
+	std::atomic<Listener*> listener { nullptr };
+	bool listenerAlsoBuffers = true;
+#if JUCE_LINUX || JUCE_MAC
+	SerialPortWakeup wakeup;
+#endif
+	friend class SerialPortVirtualPair;
+#if JUCE_LINUX
+	friend class SerialPortReactor;
+	SerialPortReactor* reactor = nullptr;
+	SerialPortReactor::Registration* registration = nullptr;
+#endif
 };
 
 //////////////////////////////////////////////////////////////////
@@ -231,13 +1440,32 @@ private:
 class JUCE_API SerialPortOutputStream : public juce::OutputStream, private juce::Thread
 {
 public:
-    SerialPortOutputStream(SerialPort * port)
-    :Thread("SerialOutThread"), port(port),bufferedbytes(0)
+	//bufferSize is how many bytes can be queued waiting to be sent. It is rounded up to a power of two,
+	//and when it is full write() waits for the writer thread to make room
+    SerialPortOutputStream(SerialPort * port, size_t bufferSize = defaultBufferSize)
+    :Thread("SerialOutThread"), port(port), buffer(bufferSize), writerWaiting(false), numWriterWakeups(0), callerWaitingForRoom(false)
+	{
+		jassert (port != nullptr);
+		//write() hands data for a virtual pair straight to the pair
+		if (port == nullptr || ! port->isVirtual())
+			startThread();
+	}
+#if JUCE_LINUX
+	//serviced by the reactor instead of a writer thread of its own
+    SerialPortOutputStream(SerialPort * port, SerialPortReactor& reactorToUse, size_t bufferSize = defaultBufferSize)
+    :Thread("SerialOutThread"), port(port), buffer(bufferSize), writerWaiting(true), numWriterWakeups(0), callerWaitingForRoom(false)
 	{
-		startThread();
+		jassert (port != nullptr);
+		reactor = &reactorToUse;
+		registration = reactor->attach (port, nullptr, this);
 	}
+#endif
 	virtual ~SerialPortOutputStream()
 	{
+	#if JUCE_LINUX
+		if (reactor != nullptr)
+			reactor->detach (registration, false);
+	#endif
 		signalThreadShouldExit();
         cancel ();
         waitForThreadToExit (5000);
@@ -247,20 +1475,417 @@ public:
 //         juce::Logger::outputDebugString ("~SerialPortOutputStream");
 	}
 	virtual void run();
-	virtual void flush(){}
+	//waits until everything written so far has left the port, the same as drain() with no timeout
+	virtual void flush() { drain(); }
+	//waits until the writer thread has handed everything written so far to the driver, and the driver has transmitted it,
+	//or timeoutMs has passed (-1 waits forever). returns false if it timed out, or the port stopped first. Anything
+	//written while this is waiting has to go too
+	bool drain (int timeoutMs = -1)
+	{
+		if (port->isVirtual())
+			return drainVirtualPair (timeoutMs);
+		const auto deadline = timeoutMs < 0 ? -1.0 : juce::Time::getMillisecondCounterHiRes() + timeoutMs;
+		while (buffer.getNumReady() > 0)
+		{
+			int waitMs = -1;
+			if (deadline >= 0)
+			{
+				waitMs = (int) std::ceil (deadline - juce::Time::getMillisecondCounterHiRes());
+				if (waitMs <= 0)
+					return false;
+			}
+			if (! isBeingServiced())
+				return false;
+			callerWaitingForEmpty = true;
+			std::atomic_thread_fence (std::memory_order_seq_cst);
+			if (buffer.getNumReady() > 0)
+				queueEmpty.wait (waitMs);
+			callerWaitingForEmpty = false;
+		}
+		if (deadline < 0)
+			return port->drain();
+		return port->drain (juce::jmax (0, (int) std::ceil (deadline - juce::Time::getMillisecondCounterHiRes())));
+	}
+	//how many bytes written haven't been handed to the driver yet. SerialPort::getNumBytesQueued() has the ones after that
+	size_t getNumBytesQueued() const { return buffer.getNumReady(); }
 	virtual bool setPosition(juce::int64 /*newPosition*/){return false;}
 	virtual juce::int64 getPosition(){return -1;}
 	virtual bool write(const void *dataToWrite, size_t howManyBytes);
+	//the same as write(), but returns how many of the bytes it queued, which is how much of the data has been dealt with
+	//when it couldn't all be. See setOverflowPolicy() for when that is
+	size_t writeSome (const void* dataToWrite, size_t howManyBytes);
     virtual void cancel ();
     SerialPort* getPort() { return port; }
     void setWriterPriority (int priority) { setPriority (priority); }
+	//how many times the writer thread has been woken up to send something. An idle port never wakes it
+	juce::uint64 getNumWriterWakeups() const { return numWriterWakeups; }
+
+	//what write() does when the queue (bufferSize bytes) is full. OVERFLOW_BLOCK, the default, waits for room for up to
+	//timeoutMs (-1 waits forever). A write that fits in the queue waits for room for all of it, so if the time runs out
+	//or the port stops first none of it has been queued. A bigger one has to go in pieces, and writeSome() says how much
+	//of it made it. OVERFLOW_FAIL returns false straight away, queueing nothing, unless all of it fits.
+	//OVERFLOW_DROP_OLDEST never waits for the port, it throws away the oldest bytes that haven't been sent yet to make
+	//room, as soon as the writer is between sends
+	enum overflowpolicy{OVERFLOW_BLOCK=0, OVERFLOW_FAIL, OVERFLOW_DROP_OLDEST};
+	void setOverflowPolicy (overflowpolicy policy, int timeoutMs = -1)
+	{
+		overflowPolicy = policy;
+		overflowTimeoutMs = timeoutMs;
+	}
+	//how many bytes OVERFLOW_DROP_OLDEST has thrown away
+	juce::uint64 getNumBytesDropped() const { return numBytesDropped; }
+
+	//told when the queue fills past the high watermark, and when it has emptied to the low one after that, so a producer
+	//can slow down and speed up again. The first is called on the thread calling write(), the second on the one taking
+	//the data off the queue (usually the writer thread, or the reactor), so both should be quick
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		virtual void queueAboveHighWatermark (SerialPortOutputStream& stream, size_t numBytesQueued) = 0;
+		virtual void queueBelowLowWatermark (SerialPortOutputStream& stream, size_t numBytesQueued) = 0;
+	};
+	//one listener at a time, nullptr to remove it. Once this returns, the previous listener won't be called again.
+	//the watermarks are in bytes, with lowWatermark below highWatermark. A highWatermark of 0 turns them off
+	void setListener (Listener* newListener, size_t highWatermark, size_t lowWatermark)
+	{
+		jassert (highWatermark == 0 || lowWatermark < highWatermark);
+		const juce::ScopedLock sl (listenerLock);
+		aboveHighWatermark = false;
+		watermarkHigh = highWatermark;
+		watermarkLow = lowWatermark;
+		listener = newListener;
+	}
+
+	static const size_t defaultBufferSize = 1 << 18;
 
 private:
+	size_t sendToVirtualPair (const void* dataToWrite, size_t howManyBytes);
+	bool drainVirtualPair (int timeoutMs);
+
+	//called by writeSome(), returning how many of the bytes it has dealt with. The lock only serialises callers, the
+	//writer thread never takes it
+	size_t addToBuffer (const void* dataToWrite, size_t howManyBytes)
+	{
+		const juce::ScopedLock l (bufferCriticalSection);
+		auto* source = static_cast<const uint8_t*> (dataToWrite);
+		const auto numToWrite = howManyBytes;
+		const overflowpolicy policy = overflowPolicy;
+		if (policy == OVERFLOW_FAIL && howManyBytes > buffer.getFreeSpace())
+			return 0;
+		//a write that fits goes in whole or not at all, so running out of time never leaves part of it queued
+		const bool whole = policy == OVERFLOW_BLOCK && howManyBytes <= buffer.getCapacity();
+		if (policy == OVERFLOW_DROP_OLDEST && howManyBytes > buffer.getCapacity())
+		{
+			//only the newest bytes fit, whatever is thrown away
+			const auto excess = howManyBytes - buffer.getCapacity();
+			dropped (excess);
+			source += excess;
+			howManyBytes -= excess;
+		}
+		const int timeoutMs = overflowTimeoutMs;
+		const auto deadline = timeoutMs < 0 ? -1.0 : juce::Time::getMillisecondCounterHiRes() + timeoutMs;
+		const auto writtenNanos = SerialPortInputStream::getTimestampNanos();
+		while (howManyBytes > 0)
+		{
+			const auto written = whole && buffer.getFreeSpace() < howManyBytes ? 0 : buffer.write (source, howManyBytes);
+			source += written;
+			howManyBytes -= written;
+			if (written > 0)
+			{
+				recordWriteTime (writtenNanos);
+				SerialPortStatistics::noteQueueSize (port->statistics.outputQueueHighWater, buffer.getNumReady());
+			}
+			std::atomic_thread_fence (std::memory_order_seq_cst);
+			if (writerWaiting)
+				triggerWriter();
+			if (written > 0)
+				checkHighWatermark();
+			if (howManyBytes > 0)
+			{
+				if (! isBeingServiced())
+					return numToWrite - howManyBytes;
+				//the writer signals as soon as it has sent something, and stoppedServicing() if it never will
+				int waitMs = -1;
+				if (policy == OVERFLOW_DROP_OLDEST)
+				{
+					if (askForRoom (howManyBytes))
+						continue;
+				}
+				else if (deadline >= 0)
+				{
+					waitMs = (int) std::ceil (deadline - juce::Time::getMillisecondCounterHiRes());
+					if (waitMs <= 0)
+						return numToWrite - howManyBytes;
+				}
+				//dropping waits for all the room it asked for, so it doesn't end up asking again for the rest
+				const auto roomNeeded = whole || policy == OVERFLOW_DROP_OLDEST ? howManyBytes : 1;
+				callerWaitingForRoom = true;
+				std::atomic_thread_fence (std::memory_order_seq_cst);
+				if (buffer.getFreeSpace() < roomNeeded)
+					roomAvailable.wait (waitMs);
+				callerWaitingForRoom = false;
+			}
+		}
+		return numToWrite;
+	}
+
+	//OVERFLOW_DROP_OLDEST's side of making room. Only the thread sending the data may take bytes off the queue, so it's
+	//asked to, and does so before its next send. returns true if the room has been made already
+	bool askForRoom (size_t numBytes)
+	{
+		size_t wanted = roomWanted;
+		while (wanted < numBytes && ! roomWanted.compare_exchange_weak (wanted, numBytes)) {}
+	#if JUCE_LINUX
+		if (reactor != nullptr)
+		{
+			//the reactor only takes bytes off the queue while it holds its lock, so this can do it straight away
+			const juce::ScopedLock sl (reactor->lock);
+			makeRequestedRoom();
+			return true;
+		}
+	#endif
+		triggerWriter();
+		return false;
+	}
+
+	//called by the thread sending the data, between sends. throws away the oldest bytes to make the room write() has asked for
+	void makeRequestedRoom()
+	{
+		const auto wanted = roomWanted.exchange (0);
+		const auto numReady = buffer.getNumReady();
+		if (wanted == 0 || numReady + wanted <= buffer.getCapacity())
+			return;
+		const auto excess = juce::jmin (numReady, numReady + wanted - buffer.getCapacity());
+		dropped (excess);
+		removeFromBuffer (excess, false);
+	}
+
+	void dropped (size_t numBytes)
+	{
+		numBytesDropped += numBytes;
+		SerialPortStatistics::add (port->statistics.bytesDroppedOut, numBytes);
+	}
+
+	void wokenUp()
+	{
+		++numWriterWakeups;
+		SerialPortStatistics::add (port->statistics.writerWakeups, 1);
+	}
+
+	//called by write() after it has added to the queue. If the sending side has fallen so far behind that there's no room
+	//to remember it, its time is left out of the write latencies
+	void recordWriteTime (juce::int64 writtenNanos)
+	{
+		const auto index = numWriteTimesWritten.load (std::memory_order_relaxed);
+		if (index - writeTimesReadIndex.load (std::memory_order_acquire) >= numWriteTimes)
+			return;
+		writeTimes[index & writeTimesMask] = { buffer.getWritePosition(), writtenNanos };
+		numWriteTimesWritten.store (index + 1, std::memory_order_release);
+	}
+
+	//called by the sending side once it has taken data off the queue. lets go of the times of the writes that have all
+	//gone, and counts how long they waited if they were sent rather than dropped
+	void forgetWriteTimes (bool sent)
+	{
+		const auto readPosition = buffer.getReadPosition();
+		const auto numWritten = numWriteTimesWritten.load (std::memory_order_acquire);
+		auto index = writeTimesReadIndex.load (std::memory_order_relaxed);
+		if (index >= numWritten || writeTimes[index & writeTimesMask].endPosition > readPosition)
+			return;
+		const auto now = SerialPortInputStream::getTimestampNanos();
+		do
+		{
+			if (sent)
+				port->statistics.writeLatency.record (now - writeTimes[index & writeTimesMask].timestampNanos);
+			++index;
+		}
+		while (index < numWritten && writeTimes[index & writeTimesMask].endPosition <= readPosition);
+		writeTimesReadIndex.store (index, std::memory_order_release);
+	}
+
+	void checkHighWatermark()
+	{
+		if (listener == nullptr || watermarkHigh == 0 || aboveHighWatermark)
+			return;
+		const juce::ScopedLock sl (listenerLock);
+		const auto numReady = buffer.getNumReady();
+		if (listener != nullptr && watermarkHigh > 0 && ! aboveHighWatermark && numReady >= watermarkHigh)
+		{
+			aboveHighWatermark = true;
+			listener.load()->queueAboveHighWatermark (*this, numReady);
+		}
+	}
+
+	void checkLowWatermark()
+	{
+		if (! aboveHighWatermark)
+			return;
+		const juce::ScopedLock sl (listenerLock);
+		const auto numReady = buffer.getNumReady();
+		if (listener != nullptr && aboveHighWatermark && numReady <= watermarkLow)
+		{
+			aboveHighWatermark = false;
+			listener.load()->queueBelowLowWatermark (*this, numReady);
+		}
+	}
+
+	//called by the writer thread when the queue is empty. It sleeps until write() or cancel() wakes it, there
+	//is no timeout. writerWaiting is raised before the queue is checked, so a write() that lands in between still signals
+	bool waitForSomethingToWrite()
+	{
+		bool keepRunning = true;
+		writerWaiting = true;
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (buffer.getNumReady() == 0 && ! threadShouldExit())
+		{
+			keepRunning = waitForTrigger();
+			wokenUp();
+		}
+		writerWaiting = false;
+		return keepRunning;
+	}
+
+	bool isBeingServiced()
+	{
+		if (port != nullptr && port->isVirtual())
+			return true;
+		if (serviceStopped)
+			return false;
+	#if JUCE_LINUX
+		if (reactor != nullptr)
+			return port->portDescriptor != -1;
+	#endif
+		return isThreadRunning();
+	}
+
+	//called by the writer thread as it leaves run(), or by the reactor when the port fails, to wake callers waiting
+	//for room or for the queue to empty
+	void stoppedServicing()
+	{
+		serviceStopped = true;
+		roomAvailable.signal();
+		queueEmpty.signal();
+	}
+
+	//platform specific. wakes the writer thread, and puts it to sleep until then, returning false if the port has been cancelled
+	void triggerWriter();
+	bool waitForTrigger();
+
+	//called by the writer thread once bytes taken from getReadRegions() have been sent, or to drop them
+	void removeFromBuffer (size_t numBytes, bool sent = true)
+	{
+		buffer.skip (numBytes);
+		forgetWriteTimes (sent);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (callerWaitingForRoom)
+			roomAvailable.signal();
+		if (callerWaitingForEmpty && buffer.getNumReady() == 0)
+			queueEmpty.signal();
+		checkLowWatermark();
+	}
+
 	SerialPort * port;
-	int bufferedbytes;
-	juce::MemoryBlock buffer;
+	SerialPortRingBuffer buffer;
 	juce::CriticalSection bufferCriticalSection;
+#if ! (JUCE_LINUX || JUCE_MAC)
 	juce::WaitableEvent triggerWrite;
-	static const uint32_t writeBufferSize = 128;
+#endif
+	std::atomic<bool> writerWaiting;
+	std::atomic<juce::uint64> numWriterWakeups;
+	std::atomic<bool> callerWaitingForRoom;
+	juce::WaitableEvent roomAvailable;
+	std::atomic<bool> callerWaitingForEmpty { false };
+	juce::WaitableEvent queueEmpty;
+	std::atomic<bool> serviceStopped { false };
+	std::atomic<overflowpolicy> overflowPolicy { OVERFLOW_BLOCK };
+	std::atomic<int> overflowTimeoutMs { -1 };
+	//how much room a write() with OVERFLOW_DROP_OLDEST is waiting for
+	std::atomic<size_t> roomWanted { 0 };
+	std::atomic<juce::uint64> numBytesDropped { 0 };
+	//the buffer position just past each piece of data write() has queued, and when write() was called
+	struct WriteRecord
+	{
+		size_t endPosition;
+		juce::int64 timestampNanos;
+	};
+	static const size_t numWriteTimes = 1024;
+	static const size_t writeTimesMask = numWriteTimes - 1;
+	WriteRecord writeTimes[numWriteTimes];
+	std::atomic<size_t> numWriteTimesWritten { 0 };
+	std::atomic<size_t> writeTimesReadIndex { 0 };
+	//held while the listener is called, so setListener() can't return part way through a call
+	juce::CriticalSection listenerLock;
+	std::atomic<Listener*> listener { nullptr };
+	size_t watermarkHigh = 0;
+	size_t watermarkLow = 0;
+	std::atomic<bool> aboveHighWatermark { false };
+#if JUCE_LINUX || JUCE_MAC
+	SerialPortWakeup wakeup;
+#endif
+#if JUCE_LINUX
+	friend class SerialPortReactor;
+	SerialPortReactor* reactor = nullptr;
+	SerialPortReactor::Registration* registration = nullptr;
+#endif
 };
+
+//////////////////////////////////////////////////////////////////
+//two ports joined back to back inside the process, like a null-modem cable, so the streams can be used with no driver
+//or hardware in the way. What is written to one end's SerialPortOutputStream turns up at the other end's
+//SerialPortInputStream. Neither stream starts a thread: unless setLineConditions() says otherwise, write() copies the
+//data straight into the other end's input buffer, waiting for its caller there if that is full. The conditions can pace
+//a direction to a baud rate, delay it, and corrupt or lose bytes on the way, to see how a protocol copes.
+//Each end takes at most one input stream, and the streams on both ends must be destroyed before the pair
+class JUCE_API SerialPortVirtualPair
+{
+public:
+	SerialPortVirtualPair();
+	~SerialPortVirtualPair();
+	//index is 0 or 1. These aren't driver ports, so open(), setConfig() and the other driver calls do nothing with them
+	SerialPort& getEnd (int index) { return *ends[index & 1]; }
+
+	struct LineConditions
+	{
+		//0 sends as fast as the far end takes the data
+		juce::uint32 bitsPerSecond = 0;
+		//the start, data, parity and stop bits that go with each byte
+		int bitsPerByte = 10;
+		//how long each byte takes to reach the far end once it has been sent
+		int delayMicroseconds = 0;
+		//the chance of each byte being hit, from 0 to 1. A parity error flips one bit of the byte, an overrun loses
+		//overrunLength bytes in a row, the way a UART does when its FIFO fills up, and a drop loses just the one byte
+		double parityErrorRate = 0.0, overrunRate = 0.0, dropRate = 0.0;
+		int overrunLength = 16;
+		//the same seed puts the same errors in the same places
+		juce::int64 seed = 1;
+	};
+	//for what is sent from end `from` to the other one, from the next byte to arrive on
+	void setLineConditions (int from, const LineConditions& conditions);
+
+	struct LineCounts
+	{
+		juce::uint64 bytesSent = 0, bytesDelivered = 0;
+		juce::uint64 parityErrors = 0, overruns = 0, bytesLost = 0;
+		//bytes that arrived while there was no input stream at the far end to take them
+		juce::uint64 bytesUnheard = 0;
+	};
+	LineCounts getLineCounts (int from) const;
+	//how many bytes sent from end `from` haven't arrived yet. Always 0 unless the line is paced or delayed
+	size_t getNumBytesInFlight (int from) const;
+	//waits until everything sent from end `from` has arrived, or timeoutMs has passed (-1 waits forever)
+	bool drain (int from, int timeoutMs = -1);
+
+private:
+	friend class SerialPortInputStream;
+	friend class SerialPortOutputStream;
+	//one direction of the pair, in juce_serialport_VirtualPair.cpp
+	class Line;
+	std::unique_ptr<SerialPort> ends[2];
+	//lines[i] carries what end i sends
+	std::unique_ptr<Line> lines[2];
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortVirtualPair)
+};
+
 #endif //_SERIALPORT_H_
@@ -3,6 +3,7 @@
 #if JUCE_ANDROID
 
 #include <stdio.h>
+#include <time.h>
 
 #include "juce_serialport.h"
 
@@ -103,10 +104,23 @@ void SerialPort::close()
 
 bool SerialPort::exists()
 {
+    if (isVirtual())
+        return true;
     auto env = getEnv();
     return ! env->IsSameObject(usbSerialHelper, NULL) && env->CallBooleanMethod (usbSerialHelper, UsbSerialHelper.isOpen);
 }
 
+//write() hands the data straight to the UsbSerialHelper, which sends it before returning, so nothing is left queued
+int SerialPort::getNumBytesQueued()
+{
+    return exists() ? 0 : -1;
+}
+
+bool SerialPort::drain (int)
+{
+    return exists();
+}
+
 bool SerialPort::open(const String & newPortPath)
 {
     portPath = newPortPath;
@@ -139,6 +153,10 @@ void SerialPort::cancel ()
 {
 }
 
+bool SerialPort::openWithConfig(const String & portPath, const SerialPortConfig & config)
+{
+    return open (portPath) && setConfig (config);
+}
 bool SerialPort::setConfig(const SerialPortConfig & config)
 {
     //flow control isn't supported/used by UsbSerialPort
@@ -187,6 +205,15 @@ bool SerialPort::setConfig(const SerialPortConfig & config)
     return env->CallBooleanMethod(usbSerialHelper, UsbSerialHelper.setParameters, config.bps, config.databits, stopBits, parity);
 }
 
+//UsbSerialPort only takes all the parameters at once
+bool SerialPort::setBaudRate (juce::uint32 bitsPerSecond)
+{
+    SerialPortConfig config;
+    if (! getConfig (config))
+        return false;
+    config.bps = bitsPerSecond;
+    return setConfig (config);
+}
 bool SerialPort::getConfig(SerialPortConfig & config)
 {
     if (! portHandle)
@@ -233,6 +260,13 @@ bool SerialPort::getConfig(SerialPortConfig & config)
 /////////////////////////////////
 // SerialPortInputStream
 /////////////////////////////////
+int64 SerialPortInputStream::getTimestampNanos()
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC_RAW, &now);
+    return (int64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
 void SerialPortInputStream::run()
 {
     try
@@ -240,39 +274,32 @@ void SerialPortInputStream::run()
         while (port && port->portDescriptor != -1 && ! threadShouldExit())
         {
             auto env = getEnv();
-            jbyteArray result = env->NewByteArray (8192);
+            jbyteArray result = env->NewByteArray (readChunkSize);
             const int bytesRead = (jint) env->CallIntMethod (port->usbSerialHelper, UsbSerialHelper.read, result);
+            SerialPortStatistics::add (port->statistics.readCalls, 1);
             if (bytesRead > 0)
             {
                 jbyte* jbuffer = env->GetByteArrayElements (result, nullptr);
-                {
-                    const ScopedLock lock(bufferCriticalSection);
-                    buffer.ensureSize(bufferedbytes + bytesRead);
-
-                    //String msg;
-                    for (int i = 0; i < bytesRead; ++i)
-                    {
-                        buffer[bufferedbytes++] = jbuffer[i];
-                        //msg += String (std::bitset<8>(static_cast<char>(buffer[bufferedbytes])).to_string()) + " ";
-                    }
-                    //port->DebugLog("*************** SerialPortInputStream::run(): " + msg);
-                }
-                env->ReleaseByteArrayElements(result, jbuffer, 0);
-
-                if (notify == NOTIFY_ALWAYS)
-                    sendChangeMessage();
+                addToBuffer (jbuffer, bytesRead);
+                env->ReleaseByteArrayElements(result, jbuffer, JNI_ABORT);
             }
             else if (bytesRead == -1)
             {
                 port->close ();
                 break;
             }
+            else
+            {
+                //nothing arrived before the helper's read timed out, which is the end of a burst
+                sendIdleNotification();
+            }
 
             env->DeleteLocalRef(result);
         }
     } catch (const std::exception& e) {
         port->DebugLog ("SerialPortInputStream::run", "EXCEPTION: " + String(e.what()));
     }
+    stoppedServicing();
 }
 
 void SerialPortInputStream::cancel ()
@@ -281,18 +308,10 @@ void SerialPortInputStream::cancel ()
 
 int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 {
-    if (! port || port->portHandle == 0)
+    if (! port || (port->portHandle == 0 && ! port->isVirtual()))
         return -1;
 
-    const ScopedLock l (bufferCriticalSection);
-
-    if (maxBytesToRead > bufferedbytes)
-        maxBytesToRead = bufferedbytes;
-
-    memcpy (destBuffer, buffer.getData (), maxBytesToRead);
-    buffer.removeSection (0, maxBytesToRead);
-    bufferedbytes -= maxBytesToRead;
-    return maxBytesToRead;
+    return readFromBuffer (destBuffer, maxBytesToRead);
 }
 
 /////////////////////////////////
@@ -302,6 +321,7 @@ void SerialPortOutputStream::run()
 {
     //TODO if this is not used, can we stop it from running?
     port->DebugLog("SerialPortOutputStream::run", "this function is called but doesn't do anything and exists immediately");
+    stoppedServicing();
 }
 
 void SerialPortOutputStream::cancel ()
@@ -312,11 +332,31 @@ void SerialPortOutputStream::cancel ()
     port->cancel ();
 }
 
+//write() goes straight to the UsbSerialHelper, so the writer thread is never used
+void SerialPortOutputStream::triggerWriter ()
+{
+    triggerWrite.signal ();
+}
+
+bool SerialPortOutputStream::waitForTrigger ()
+{
+    triggerWrite.wait ();
+    return true;
+}
+
 bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
+{
+    return writeSome (dataToWrite, howManyBytes) == howManyBytes;
+}
+
+//the helper's write is all or nothing
+size_t SerialPortOutputStream::writeSome (const void* dataToWrite, size_t howManyBytes)
 {
     auto result = false;
+    if (port != nullptr && port->isVirtual())
+        return sendToVirtualPair (dataToWrite, howManyBytes);
     if (! port || port->portHandle == 0)
-        return result;
+        return 0;
 
     try {
         auto env = getEnv();
@@ -333,12 +373,13 @@ bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
 
         env->SetByteArrayRegion(jByteArray, 0, howManyBytes, cSignedCharArray);
         result = (jboolean) env->CallBooleanMethod(port->usbSerialHelper, UsbSerialHelper.write, jByteArray);
+        port->statistics.countWriteCall (result ? (long) howManyBytes : 0);
         env->DeleteLocalRef(jByteArray);
     } catch (const std::exception& e) {
         port->DebugLog ("SerialPortOutputStream::write", "EXCEPTION: " + String(e.what()));
-        return false;
+        return 0;
     }
 
-    return result;
+    return result ? howManyBytes : 0;
 }
 #endif // JUCE_ANDROID
@@ -0,0 +1,50 @@
+//juce_serialport_Common.cpp
+//the parts of SerialPort that are the same on every platform, so this is built for all of them
+//see juce_serialport.h for details
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include "juce_serialport.h"
+
+/////////////////////////////////
+// SerialPort
+/////////////////////////////////
+void SerialPort::openAll (const StringArray& paths, const SerialPortConfig& config, OwnedArray<OpenedPort>& results,
+                          int numThreads, DebugFunction debugLog)
+{
+	results.clear();
+	for (auto& path : paths)
+		results.add (new OpenedPort())->path = path;
+
+	//each thread takes the next port that hasn't been started on, until there are none left
+	struct Opener : public Thread
+	{
+		Opener (OwnedArray<OpenedPort>& r, const SerialPortConfig& c, DebugFunction d, std::atomic<int>& n)
+			: Thread ("SerialOpenThread"), results (r), config (c), debugLog (d), next (n) {}
+		void run() override
+		{
+			for (int i = next++; i < results.size(); i = next++)
+			{
+				auto* opened = results[i];
+				const auto start = Time::getMillisecondCounterHiRes();
+				std::unique_ptr<SerialPort> port (new SerialPort (debugLog));
+				if (port->openWithConfig (opened->path, config))
+					opened->port = std::move (port);
+				opened->milliseconds = Time::getMillisecondCounterHiRes() - start;
+			}
+		}
+		OwnedArray<OpenedPort>& results;
+		const SerialPortConfig& config;
+		DebugFunction debugLog;
+		std::atomic<int>& next;
+	};
+	std::atomic<int> next { 0 };
+	OwnedArray<Opener> openers;
+	for (int i = jlimit (1, jmax (1, results.size()), numThreads); --i >= 0;)
+		openers.add (new Opener (results, config, debugLog, next))->startThread();
+	for (auto* opener : openers)
+		opener->waitForThreadToExit (-1);
+}
@@ -0,0 +1,1485 @@
+//linux_SerialPort.cpp
+//Serial Port classes in a Juce stylee
+//see SerialPort.h for details
+//
+// Linux version of mac_SerialPort.cpp, using termios2 for the port settings and
+// epoll/eventfd so the stream threads never sit in a blocking read, and can be stopped at any time
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <termios.h>
+#include <time.h>
+#include <stdlib.h>
+#include <linux/serial.h>
+#include "juce_serialport.h"
+
+// glibc's struct termios is not the one the kernel uses, and <asm/termbits.h> can't be included
+// alongside <termios.h>, so the termios2 layout needed for arbitrary baud rates is declared here.
+// NCCS is 19 on x86, arm, arm64 and riscv
+struct SerialPortTermios2
+{
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+ #define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+ #define IBSHIFT 16
+#endif
+
+static const unsigned long SERIALPORT_TCGETS2 = _IOR('T', 0x2A, SerialPortTermios2);
+static const unsigned long SERIALPORT_TCSETS2 = _IOW('T', 0x2B, SerialPortTermios2);
+
+static void makeRaw (SerialPortTermios2& options)
+{
+	//same as cfmakeraw(), which only works on glibc's termios
+	options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+	options.c_oflag &= ~OPOST;
+	options.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	options.c_cflag &= ~(CSIZE | PARENB);
+	options.c_cflag |= CS8;
+}
+
+static bool isPresent8250Port (const String& devicePath)
+{
+	//the 8250 driver registers ttyS0-31 whether or not there is a uart behind them
+	const int fd = ::open (devicePath.getCharPointer(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	struct serial_struct serialInfo;
+	const bool present = ioctl (fd, TIOCGSERIAL, &serialInfo) == 0 && serialInfo.type != PORT_UNKNOWN;
+	::close (fd);
+	return present;
+}
+
+//a usb-serial adapter's latency timer lives with its device in /sys/bus/usb-serial/devices, which the tty's device link
+//leads to. Ports opened through a link such as /dev/serial/by-id are followed to the real tty first
+static String getLatencyTimerPath (const String& portPath)
+{
+	char resolvedPath[PATH_MAX];
+	const String devicePath (realpath (portPath.getCharPointer(), resolvedPath) != nullptr ? String (resolvedPath) : portPath);
+	return "/sys/class/tty/" + devicePath.fromLastOccurrenceOf ("/", false, false) + "/device/latency_timer";
+}
+
+//the text of a sysfs file without the newline, or an empty string if it isn't there
+static String readSysfsAttribute (const String& attributePath)
+{
+	const int fd = ::open (attributePath.getCharPointer(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return {};
+	char text[256];
+	const auto length = ::read (fd, text, sizeof (text));
+	::close (fd);
+	if (length <= 0)
+		return {};
+	return String::fromUTF8 (text, (int) length).trim();
+}
+
+//in milliseconds, or -1 if the port doesn't have one
+static int readLatencyTimer (const String& timerPath)
+{
+	const auto text = readSysfsAttribute (timerPath);
+	return text.isEmpty() ? -1 : text.getIntValue();
+}
+
+static bool writeLatencyTimer (const String& timerPath, int milliseconds)
+{
+	const int fd = ::open (timerPath.getCharPointer(), O_WRONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	const String text (milliseconds);
+	const bool written = ::write (fd, text.getCharPointer(), (size_t) text.length()) == (ssize_t) text.length();
+	::close (fd);
+	return written;
+}
+
+StringPairArray SerialPort::getSerialPortPaths()
+{
+	StringPairArray SerialPortPaths;
+	for (auto& info : SerialPortEnumerator::getShared().getPorts())
+		SerialPortPaths.set (info.name, info.path);
+	return SerialPortPaths;
+}
+bool SerialPort::exists()
+{
+	return (-1!=portDescriptor) || isVirtual();
+}
+int SerialPort::getNumBytesQueued()
+{
+	int numBytes = 0;
+	if (-1 == portDescriptor || ioctl(portDescriptor, TIOCOUTQ, &numBytes) == -1)
+		return -1;
+	return numBytes;
+}
+bool SerialPort::drain (int timeoutMs)
+{
+	//tcdrain() can't be given a timeout or be cancelled, so the driver's queue is watched until it's empty, sleeping
+	//for about as long as the rest of it takes to send. tcdrain() then only has the uart's fifo left to wait for
+	const auto deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+	SerialPortTermios2 options;
+	const auto bitsPerSecond = ioctl(portDescriptor, SERIALPORT_TCGETS2, &options) == 0 ? jmax ((speed_t) 1, options.c_ospeed) : (speed_t) 9600;
+	for (;;)
+	{
+		const int numBytes = getNumBytesQueued();
+		if (numBytes == -1 || canceled)
+			return false;
+		if (numBytes == 0)
+			break;
+		auto sleepMs = jmax (1, (int) ((juce::int64) numBytes * 10000 / (juce::int64) bitsPerSecond));
+		if (timeoutMs >= 0)
+		{
+			const auto remaining = (int) std::ceil (deadline - Time::getMillisecondCounterHiRes());
+			if (remaining <= 0)
+				return false;
+			sleepMs = jmin (sleepMs, remaining);
+		}
+		Thread::sleep (jmin (sleepMs, 100));
+	}
+	return tcdrain(portDescriptor) == 0;
+}
+void SerialPort::close()
+{
+    DebugLog ("SerialPort::close", "closing port:" + portPath);
+
+	//only tells the stream threads to stop, it doesn't wait for them. They have either gone already, or this is one of
+	//them (or the reactor) closing a port that has hung up
+	cancel();
+	if(-1 != portDescriptor)
+	{
+		if (lowLatencyFlagChanged || originalLatencyTimer != -1)
+			setDriverLatency (false);
+		::close(portDescriptor);
+		portDescriptor = -1;
+	}
+	latencySettingsApplied = 0;
+}
+bool SerialPort::openDescriptor(const String & portPath)
+{
+	this->portPath = portPath;
+    DebugLog ("SerialPort::open", "opening port:" + this->portPath);
+	canceled = false;
+	cancelWakeup.clear();
+	configApplied = latencyApplied = false;
+	latencySettingsApplied = 0;
+
+	//the descriptor is left non-blocking, the stream threads wait on it with epoll
+	portDescriptor = ::open(portPath.getCharPointer(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (portDescriptor == -1)
+    {
+        DebugLog ("SerialPort::open", "open() failed");
+        return false;
+    }
+    // don't allow multiple opens
+    if (ioctl(portDescriptor, TIOCEXCL) == -1)
+    {
+        DebugLog ("SerialPort::open", "ioctl error, non critical");
+    }
+	return true;
+}
+bool SerialPort::open(const String & portPath)
+{
+	return openDescriptor (portPath) && setRawSettings();
+}
+bool SerialPort::setRawSettings()
+{
+	SerialPortTermios2 options;
+	// Get the current options
+    if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &options) == -1)
+    {
+        DebugLog ("SerialPort::open", "can't get port settings");
+		close();
+        return false;
+    }
+	//non canonical, VMIN of 1 so that a non-blocking read with nothing to return fails with EAGAIN,
+	//and a return of 0 only ever means the tty has gone away
+	makeRaw(options);
+	options.c_cflag |= CREAD | CLOCAL;
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+	if (ioctl(portDescriptor, SERIALPORT_TCSETS2, &options) == -1)
+    {
+        DebugLog ("SerialPort::open", "can't set port settings");
+		close();
+        return false;
+    }
+	return true;
+}
+//the termios made from the config is the only one set, and setConfig() reads it back the once. What the port had
+//before doesn't matter, as makeOptions() starts from nothing
+bool SerialPort::openWithConfig(const String & portPath, const SerialPortConfig & config)
+{
+	if (! openDescriptor (portPath))
+		return false;
+	if (setConfig (config))
+		return true;
+	//the tty still has whatever settings it had before, which could be canonical with echo on
+	DebugLog ("SerialPort::openWithConfig", "can't apply the config, falling back to the raw settings");
+	setRawSettings();
+	return false;
+}
+void SerialPort::cancel ()
+{
+	canceled = true;
+	cancelWakeup.signal();
+}
+
+//the termios2 for a config, or false if it can't be done on Linux
+static bool makeOptions (const SerialPortConfig& config, SerialPortTermios2& options)
+{
+	memset(&options, 0, sizeof(options));
+	makeRaw(options);
+	options.c_cflag &= ~CSIZE;
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+	options.c_cflag |= CREAD; //enable reciever (daft)
+	options.c_cflag |= CLOCAL;//don't monitor modem control lines
+	//baud, BOTHER takes the rate as an integer so non-standard rates work too
+	options.c_cflag |= BOTHER;
+	options.c_ispeed = config.bps;
+	options.c_ospeed = config.bps;
+	switch(config.databits)
+	{
+		case 5: options.c_cflag |= CS5; break;
+		case 6: options.c_cflag |= CS6; break;
+		case 7: options.c_cflag |= CS7; break;
+		case 8: options.c_cflag |= CS8; break;
+	}
+	//parity
+	switch(config.parity)
+	{
+	case SerialPortConfig::SERIALPORT_PARITY_ODD:
+		options.c_cflag |= PARENB;
+		options.c_cflag |= PARODD;
+		break;
+	case SerialPortConfig::SERIALPORT_PARITY_EVEN:
+		options.c_cflag |= PARENB;
+		break;
+	case SerialPortConfig::SERIALPORT_PARITY_MARK:
+		options.c_cflag |= PARENB | CMSPAR | PARODD;
+		break;
+	case SerialPortConfig::SERIALPORT_PARITY_SPACE:
+		options.c_cflag |= PARENB | CMSPAR;
+		break;
+	case SerialPortConfig::SERIALPORT_PARITY_NONE:
+	default:
+		break;
+	}
+	//stopbits
+	if (config.stopbits==SerialPortConfig::STOPBITS_1ANDHALF)
+		return false;//not supported
+	if(config.stopbits==SerialPortConfig::STOPBITS_2)
+		options.c_cflag |= CSTOPB;
+	//flow control
+	switch(config.flowcontrol)
+	{
+	case SerialPortConfig::FLOWCONTROL_XONXOFF:
+		options.c_iflag |= IXON;
+		options.c_iflag |= IXOFF;
+		break;
+	case SerialPortConfig::FLOWCONTROL_HARDWARE:
+		options.c_cflag |= CRTSCTS;
+		break;
+	case SerialPortConfig::FLOWCONTROL_NONE:
+	default:
+		break;
+	}
+	return true;
+}
+
+//everything but the latency, which isn't part of the termios
+static bool sameLineSettings (const SerialPortConfig& a, const SerialPortConfig& b)
+{
+	return a.bps == b.bps && a.databits == b.databits && a.parity == b.parity && a.stopbits == b.stopbits && a.flowcontrol == b.flowcontrol;
+}
+
+//whether the driver took the settings that matter. Drivers that can't make the exact speed report the nearest one they
+//can, which is fine as long as it's within what a uart will put up with
+static bool driverTookOptions (const SerialPortTermios2& wanted, const SerialPortTermios2& actual)
+{
+	const tcflag_t cflags = CSIZE | PARENB | PARODD | CMSPAR | CSTOPB | CRTSCTS;
+	const tcflag_t iflags = IXON | IXOFF;
+	const auto closeEnough = [] (speed_t want, speed_t got) { return std::abs ((double) got - (double) want) <= (double) want * 0.03; };
+	return (wanted.c_cflag & cflags) == (actual.c_cflag & cflags) && (wanted.c_iflag & iflags) == (actual.c_iflag & iflags)
+		&& closeEnough (wanted.c_ospeed, actual.c_ospeed) && closeEnough (wanted.c_ispeed, actual.c_ispeed);
+}
+
+//reconfiguring can reset the line and flush the fifos on some usb adapters, so the termios is only set when the line
+//settings have changed since the last time, and the driver settings only when the latency has. The settings are read
+//back once after they have been set, to make sure the driver took them
+bool SerialPort::setConfig(const SerialPortConfig & config)
+{
+	if(-1==portDescriptor)return false;
+	if (! configApplied || ! sameLineSettings (config, appliedConfig))
+	{
+		configApplied = false;
+		SerialPortTermios2 options, actual;
+		if (! makeOptions (config, options))
+		{
+			DebugLog ("SerialPort::setConfig", "STOPBITS_1ANDHALF not supported on Linux");
+			return false;
+		}
+		if (ioctl(portDescriptor, SERIALPORT_TCSETS2, &options) == -1)
+		{
+			DebugLog("SerialPort::setConfig", "can't set port settings");
+			return false;
+		}
+		if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &actual) == -1 || ! driverTookOptions (options, actual))
+		{
+			DebugLog("SerialPort::setConfig", "the driver didn't take all the port settings");
+			return false;
+		}
+		configApplied = true;
+		appliedConfig.bps = config.bps;
+		appliedConfig.databits = config.databits;
+		appliedConfig.parity = config.parity;
+		appliedConfig.stopbits = config.stopbits;
+		appliedConfig.flowcontrol = config.flowcontrol;
+	}
+	//VMIN 1 and VTIME 0 already have the tty wake the stream threads for every byte, so what's left is in the driver
+	if (! latencyApplied || config.latency != appliedConfig.latency)
+	{
+		setDriverLatency (config.latency == SerialPortConfig::LATENCY_LOW);
+		latencyApplied = true;
+		appliedConfig.latency = config.latency;
+	}
+	return true;
+}
+bool SerialPort::setBaudRate (juce::uint32 bitsPerSecond)
+{
+	if(-1==portDescriptor)return false;
+	SerialPortTermios2 options;
+	//with the rest of the settings known, the termios can be made up here without reading it first. It's read back
+	//as setConfig() does, as a driver can round the speed or refuse it
+	if (configApplied)
+	{
+		if (bitsPerSecond == appliedConfig.bps)
+			return true;
+		SerialPortConfig config (appliedConfig);
+		config.bps = bitsPerSecond;
+		SerialPortTermios2 actual;
+		if (! makeOptions (config, options))
+			return false;
+		//what's on the port may no longer be appliedConfig after this, so it's only trusted again once verified
+		configApplied = false;
+		if (ioctl(portDescriptor, SERIALPORT_TCSETS2, &options) == -1)
+		{
+			DebugLog("SerialPort::setBaudRate", "can't set baud rate");
+			return false;
+		}
+		if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &actual) == -1 || ! driverTookOptions (options, actual))
+		{
+			DebugLog("SerialPort::setBaudRate", "the driver didn't take the baud rate");
+			return false;
+		}
+		configApplied = true;
+		appliedConfig.bps = bitsPerSecond;
+		return true;
+	}
+	if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &options) == -1)
+	{
+		DebugLog("SerialPort::setBaudRate", "can't get port settings");
+		return false;
+	}
+	//the input speed follows the output one when its bits are left clear
+	options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	options.c_cflag |= BOTHER;
+	options.c_ispeed = bitsPerSecond;
+	options.c_ospeed = bitsPerSecond;
+	SerialPortTermios2 actual;
+	if (ioctl(portDescriptor, SERIALPORT_TCSETS2, &options) == -1)
+	{
+		DebugLog("SerialPort::setBaudRate", "can't set baud rate");
+		return false;
+	}
+	if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &actual) == -1 || ! driverTookOptions (options, actual))
+	{
+		DebugLog("SerialPort::setBaudRate", "the driver didn't take the baud rate");
+		return false;
+	}
+	return true;
+}
+void SerialPort::setDriverLatency (bool low)
+{
+	latencySettingsApplied = 0;
+	struct serial_struct serialInfo;
+	if ((low || lowLatencyFlagChanged) && ioctl(portDescriptor, TIOCGSERIAL, &serialInfo) == 0)
+	{
+		const bool flagWasSet = (serialInfo.flags & ASYNC_LOW_LATENCY) != 0;
+		if (low && ! flagWasSet)
+		{
+			serialInfo.flags |= ASYNC_LOW_LATENCY;
+			lowLatencyFlagChanged = ioctl(portDescriptor, TIOCSSERIAL, &serialInfo) == 0;
+			if (! lowLatencyFlagChanged)
+				DebugLog ("SerialPort::setConfig", "can't set ASYNC_LOW_LATENCY");
+		}
+		else if (! low && flagWasSet)
+		{
+			serialInfo.flags &= ~ASYNC_LOW_LATENCY;
+			ioctl(portDescriptor, TIOCSSERIAL, &serialInfo);
+			lowLatencyFlagChanged = false;
+		}
+		if (low && (flagWasSet || lowLatencyFlagChanged))
+			latencySettingsApplied |= LATENCY_SETTING_LOW_LATENCY_FLAG;
+	}
+	if (! low && originalLatencyTimer == -1)
+		return;
+	const auto timerPath = getLatencyTimerPath (portPath);
+	if (low)
+	{
+		const auto timer = readLatencyTimer (timerPath);
+		if (timer > 1 && writeLatencyTimer (timerPath, 1) && originalLatencyTimer == -1)
+			originalLatencyTimer = timer;
+		if (timer != -1 && readLatencyTimer (timerPath) == 1)
+			latencySettingsApplied |= LATENCY_SETTING_USB_LATENCY_TIMER;
+		else if (timer != -1)
+			DebugLog ("SerialPort::setConfig", "can't write " + timerPath);
+	}
+	else
+	{
+		writeLatencyTimer (timerPath, originalLatencyTimer);
+		originalLatencyTimer = -1;
+	}
+}
+bool SerialPort::getConfig(SerialPortConfig & config)
+{
+	SerialPortTermios2 options;
+	if(-1==portDescriptor)return false;
+	if (ioctl(portDescriptor, SERIALPORT_TCGETS2, &options) == -1)
+    {
+        DebugLog("SerialPort::getConfig", "cannot get port settings");
+        return false;
+    }
+	//the kernel always fills in the actual rates, whichever way they were set
+	config.bps = options.c_ispeed > options.c_ospeed ? options.c_ispeed : options.c_ospeed;
+	switch(options.c_cflag & CSIZE)
+	{
+	case CS5: config.databits=5; break;
+	case CS6: config.databits=6; break;
+	case CS7: config.databits=7; break;
+	case CS8: config.databits=8; break;
+	}
+	config.parity = SerialPortConfig::SERIALPORT_PARITY_NONE;
+	if(options.c_cflag & PARENB)
+	{
+		if(options.c_cflag & CMSPAR)
+			config.parity = (options.c_cflag & PARODD) ? SerialPortConfig::SERIALPORT_PARITY_MARK : SerialPortConfig::SERIALPORT_PARITY_SPACE;
+		else if(options.c_cflag & PARODD)config.parity = SerialPortConfig::SERIALPORT_PARITY_ODD;
+		else config.parity = SerialPortConfig::SERIALPORT_PARITY_EVEN;
+	}
+	//stopbits
+	config.stopbits = SerialPortConfig::STOPBITS_1;
+	if(options.c_cflag & CSTOPB)config.stopbits = SerialPortConfig::STOPBITS_2;
+	//flow control
+	config.flowcontrol=SerialPortConfig::FLOWCONTROL_NONE;
+	if((options.c_iflag & IXON) || (options.c_iflag & IXOFF))
+		config.flowcontrol=SerialPortConfig::FLOWCONTROL_XONXOFF;
+	else if(options.c_cflag & CRTSCTS)
+		config.flowcontrol=SerialPortConfig::FLOWCONTROL_HARDWARE;
+	//low if either of the driver's settings is. Once setConfig() has been at them, setDriverLatency() has already found
+	//out, so sysfs is only read for a port that has only been opened
+	if (latencyApplied)
+	{
+		config.latency = latencySettingsApplied != 0 ? SerialPortConfig::LATENCY_LOW : SerialPortConfig::LATENCY_DEFAULT;
+	}
+	else
+	{
+		struct serial_struct serialInfo;
+		const bool lowLatencyFlag = ioctl(portDescriptor, TIOCGSERIAL, &serialInfo) == 0 && (serialInfo.flags & ASYNC_LOW_LATENCY) != 0;
+		config.latency = lowLatencyFlag || readLatencyTimer (getLatencyTimerPath (portPath)) == 1 ? SerialPortConfig::LATENCY_LOW : SerialPortConfig::LATENCY_DEFAULT;
+	}
+
+	return true;
+}
+/////////////////////////////////
+// SerialPortWakeup
+/////////////////////////////////
+SerialPortWakeup::SerialPortWakeup()
+{
+	readDescriptor = writeDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+SerialPortWakeup::~SerialPortWakeup()
+{
+	if (readDescriptor != -1)
+		::close (readDescriptor);
+}
+
+void SerialPortWakeup::signal()
+{
+	const uint64_t one = 1;
+	const auto result = ::write (writeDescriptor, &one, sizeof (one));
+	ignoreUnused (result);
+}
+
+void SerialPortWakeup::clear()
+{
+	uint64_t count;
+	const auto result = ::read (readDescriptor, &count, sizeof (count));
+	ignoreUnused (result);
+}
+
+enum { portReady = 0, streamWoken, portCancelled };
+
+//the reader's wait set: the port, the stream's own wakeup, and the port's cancel wakeup
+static int createPortEpoll (int portDescriptor, const SerialPortWakeup& streamWakeup, const SerialPortWakeup& portWakeup)
+{
+	const int epollDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+	if (epollDescriptor == -1)
+		return -1;
+	const int descriptors[] = { portDescriptor, streamWakeup.getDescriptor(), portWakeup.getDescriptor() };
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		epoll_event event {};
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		if (epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, descriptors[i], &event) == -1)
+		{
+			::close (epollDescriptor);
+			return -1;
+		}
+	}
+	return epollDescriptor;
+}
+
+//waits on a set made by createPortEpoll(). A stream wakeup or a timeout returns true, as the caller
+//checks threadShouldExit() anyway. returns false if the port has been cancelled
+static bool waitForPort (int epollDescriptor, SerialPortWakeup& streamWakeup, int timeoutMs = -1)
+{
+	epoll_event events[3];
+	for (;;)
+	{
+		const auto numEvents = epoll_wait (epollDescriptor, events, 3, timeoutMs);
+		if (numEvents == -1 && errno == EINTR)
+			continue;
+		if (numEvents == 0)
+			return true;
+		if (numEvents < 0)
+			return false;
+		for (int i = 0; i < numEvents; ++i)
+		{
+			if (events[i].data.u32 == portCancelled)
+				return false;
+			if (events[i].data.u32 == streamWoken)
+				streamWakeup.clear();
+		}
+		return true;
+	}
+}
+
+//the writer only needs the port in its wait set when the driver is full, so it uses poll() rather than keeping
+//an epoll set. portEvents of 0 waits for the wakeups alone. Same return value as waitForPort()
+static bool pollPort (int portDescriptor, short portEvents, SerialPortWakeup& streamWakeup, const SerialPortWakeup& portWakeup)
+{
+	pollfd descriptors[3] = { { streamWakeup.getDescriptor(), POLLIN, 0 }, { portWakeup.getDescriptor(), POLLIN, 0 }, { portDescriptor, portEvents, 0 } };
+	while (poll (descriptors, portEvents != 0 ? 3 : 2, -1) == -1)
+		if (errno != EINTR)
+			return false;
+	if (descriptors[1].revents != 0)
+		return false;
+	if (descriptors[0].revents != 0)
+		streamWakeup.clear();
+	return true;
+}
+
+/////////////////////////////////
+// SerialPortInputStream
+/////////////////////////////////
+int64 SerialPortInputStream::getTimestampNanos()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC_RAW, &now);
+	return (int64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void SerialPortInputStream::cancel ()
+{
+	signalThreadShouldExit();
+	wakeup.signal();
+}
+
+void SerialPortInputStream::run()
+{
+    //port->DebugLog ("SerialPortInputStream::run", "starting thread");
+
+	if (port == nullptr || port->portDescriptor == -1)
+	{
+		stoppedServicing();
+		return;
+	}
+	const int epollDescriptor = createPortEpoll (port->portDescriptor, wakeup, port->cancelWakeup);
+	if (epollDescriptor == -1)
+	{
+		port->DebugLog ("SerialPortInputStream::run", "can't create epoll set, errno: " + String (errno));
+		stoppedServicing();
+		return;
+	}
+
+    HeapBlock<unsigned char> chunk;
+    int chunkSize = 0;
+    while (port != nullptr && port->portDescriptor != -1 && ! threadShouldExit ())
+    {
+        if (chunkSize != readChunkSize)
+        {
+            chunkSize = readChunkSize;
+            chunk.malloc (chunkSize);
+        }
+		//take everything the driver has in one go, rather than a byte at a time
+        const auto bytesread = ::read (port->portDescriptor, chunk, chunkSize);
+        SerialPortStatistics::add (port->statistics.readCalls, 1);
+        if (bytesread > 0)
+        {
+            addToBuffer (chunk, (int) bytesread, getTimestampNanos());
+        }
+        else if (bytesread == -1 && (errno == EAGAIN || errno == EINTR))
+        {
+			//the driver is empty, which is the end of a burst
+			if (! waitForPort (epollDescriptor, wakeup, sendIdleNotification()))
+				break;
+			SerialPortStatistics::add (port->statistics.readerWakeups, 1);
+        }
+        else
+        {
+			//a return of 0 means the tty has been hung up
+            port->DebugLog ("SerialPortInputStream::run", "::read() returned " + String(bytesread) + ", errno: " + String (errno));
+            port->close ();
+            break;
+        }
+    }
+	::close (epollDescriptor);
+
+    //port->DebugLog ("SerialPortInputStream::run", "stopping thread");
+	stoppedServicing();
+}
+
+int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
+{
+    if (port != nullptr && (port->portDescriptor != -1 || port->isVirtual()))
+        return readFromBuffer (destBuffer, maxBytesToRead);
+    else
+        return -1;
+}
+/////////////////////////////////
+// SerialPortOutputStream
+/////////////////////////////////
+void SerialPortOutputStream::cancel ()
+{
+	signalThreadShouldExit();
+	wakeup.signal();
+}
+
+void SerialPortOutputStream::triggerWriter()
+{
+	if (reactor != nullptr)
+	{
+		writerWaiting = false;
+		wokenUp();
+		reactor->setInterest (registration, false, true);
+		return;
+	}
+	wakeup.signal();
+}
+
+bool SerialPortOutputStream::waitForTrigger()
+{
+	return pollPort (port->portDescriptor, 0, wakeup, port->cancelWakeup);
+}
+
+void SerialPortOutputStream::run()
+{
+    //port->DebugLog ("SerialPortOutputStream::run", "starting thread");
+
+    while(port && (port->portDescriptor!=-1) && !threadShouldExit())
+    {
+        makeRequestedRoom();
+        if (buffer.getNumReady() == 0)
+        {
+            if (! waitForSomethingToWrite())
+                break;
+            continue;
+        }
+        //send straight out of the queue, both regions in one call if it has wrapped around
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t size1, size2;
+        buffer.getReadRegions (block1, size1, block2, size2);
+        if (size1 > 0)
+        {
+            struct iovec regions[2] = { { (void*) block1, size1 }, { (void*) block2, size2 } };
+            const auto byteswritten = ::writev(port->portDescriptor, regions, size2 > 0 ? 2 : 1);
+            port->statistics.countWriteCall (byteswritten);
+            if (byteswritten>0)
+            {
+                removeFromBuffer ((size_t) byteswritten);
+            }
+            else if (byteswritten == -1 && (errno == EAGAIN || errno == EINTR))
+            {
+				//the driver's queue is full, wait for room rather than spinning
+				if (! pollPort (port->portDescriptor, POLLOUT, wakeup, port->cancelWakeup))
+					break;
+            }
+            else
+            {
+                port->DebugLog ("SerialPortOutputStream::run", "::write() couldn't write anything, errno: " + String (errno));
+                port->close ();
+                break;
+            }
+        }
+    }
+    //port->DebugLog ("SerialPortOutputStream::run", "stopping thread");
+	stoppedServicing();
+}
+
+bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
+{
+	return writeSome (dataToWrite, howManyBytes) == howManyBytes;
+}
+
+size_t SerialPortOutputStream::writeSome (const void* dataToWrite, size_t howManyBytes)
+{
+	if (port->isVirtual())
+		return sendToVirtualPair (dataToWrite, howManyBytes);
+	return addToBuffer (dataToWrite, howManyBytes);
+}
+
+/////////////////////////////////
+// SerialPortReactor
+/////////////////////////////////
+struct SerialPortReactor::Registration
+{
+	SerialPort* port;
+	int descriptor;
+	SerialPortInputStream* input;
+	SerialPortOutputStream* output;
+	//the interest flags and the epoll_ctl() that applies them are changed together, as the reader's caller,
+	//the writer's caller and the reactor thread can all change them
+	SpinLock interestLock;
+	bool wantInput;
+	bool wantOutput;
+	bool failed;
+	bool detached;
+};
+
+SerialPortReactor::SerialPortReactor (const String& threadName) : Thread (threadName), chunkSize (0)
+{
+	epollDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+	epoll_event event {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	if (epollDescriptor == -1 || epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, wakeup.getDescriptor(), &event) == -1)
+		return;
+	startThread();
+}
+
+SerialPortReactor::~SerialPortReactor()
+{
+	//every stream should have been destroyed before the reactor
+	jassert (registrations.size() == 0);
+	signalThreadShouldExit();
+	wakeup.signal();
+	waitForThreadToExit (5000);
+	if (epollDescriptor != -1)
+		::close (epollDescriptor);
+}
+
+int SerialPortReactor::getNumPorts() const
+{
+	const ScopedLock sl (lock);
+	return registrations.size();
+}
+
+SerialPortReactor::Registration* SerialPortReactor::attach (SerialPort* port, SerialPortInputStream* input, SerialPortOutputStream* output)
+{
+	const ScopedLock sl (lock);
+	for (auto* r : registrations)
+	{
+		if (r->port == port && ! r->failed)
+		{
+			//the second stream of a port shares the first one's registration
+			if (input != nullptr)
+				r->input = input;
+			if (output != nullptr)
+				r->output = output;
+			if (input != nullptr)
+				setInterest (r, true, true);
+			return r;
+		}
+	}
+	auto* r = registrations.add (new Registration());
+	r->port = port;
+	r->descriptor = port != nullptr ? port->portDescriptor : -1;
+	r->input = input;
+	r->output = output;
+	r->wantInput = input != nullptr;
+	r->wantOutput = false;
+	r->failed = r->descriptor == -1;
+	r->detached = false;
+	if (! r->failed)
+	{
+		epoll_event event {};
+		event.events = r->wantInput ? (uint32_t) EPOLLIN : 0;
+		event.data.ptr = r;
+		if (epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, r->descriptor, &event) == -1)
+		{
+			port->DebugLog ("SerialPortReactor::attach", "can't add the port to the epoll set, errno: " + String (errno));
+			r->failed = true;
+		}
+	}
+	return r;
+}
+
+void SerialPortReactor::detach (Registration* r, bool input)
+{
+	//taking the lock waits for the reactor thread to finish with any batch of events that may involve this stream
+	const ScopedLock sl (lock);
+	if (input)
+	{
+		setInterest (r, true, false);
+		r->input = nullptr;
+		pendingNotifications.removeFirstMatchingValue (r);
+	}
+	else
+	{
+		setInterest (r, false, false);
+		r->output = nullptr;
+	}
+	if (r->input != nullptr || r->output != nullptr)
+		return;
+	if (! r->failed && r->port->portDescriptor == r->descriptor)
+		epoll_ctl (epollDescriptor, EPOLL_CTL_DEL, r->descriptor, nullptr);
+	r->detached = true;
+	registrations.removeObject (r, false);
+	retired.add (r);
+}
+
+void SerialPortReactor::setInterest (Registration* r, bool input, bool enabled)
+{
+	const SpinLock::ScopedLockType sl (r->interestLock);
+	bool& flag = input ? r->wantInput : r->wantOutput;
+	if (flag == enabled)
+		return;
+	flag = enabled;
+	//once the port has been closed its descriptor may already belong to something else
+	if (r->failed || r->port->portDescriptor != r->descriptor)
+		return;
+	epoll_event event {};
+	event.events = (r->wantInput ? (uint32_t) EPOLLIN : 0) | (r->wantOutput ? (uint32_t) EPOLLOUT : 0);
+	event.data.ptr = r;
+	epoll_ctl (epollDescriptor, EPOLL_CTL_MOD, r->descriptor, &event);
+}
+
+void SerialPortReactor::portFailed (Registration& r, const String& method, const String& message)
+{
+	r.port->DebugLog (method, message);
+	{
+		const SpinLock::ScopedLockType sl (r.interestLock);
+		r.failed = true;
+	}
+	//closing the descriptor takes it out of the epoll set
+	r.port->close();
+	if (r.input != nullptr)
+		r.input->stoppedServicing();
+	if (r.output != nullptr)
+		r.output->stoppedServicing();
+}
+
+bool SerialPortReactor::serviceInput (Registration& r)
+{
+	auto& stream = *r.input;
+	const bool blockWhenFull = stream.overflowPolicy == SerialPortInputStream::OVERFLOW_BLOCK;
+	const auto freeSpace = stream.buffer.getFreeSpace();
+	if (freeSpace == 0 && blockWhenFull)
+	{
+		//stop watching the port until the caller has read something. The flag is raised after that and before the
+		//buffer is checked again, so a read() that lands in between turns it back on. A caller that only reads when
+		//told to would never make the room, so anything held back goes first
+		++stream.numOverflows;
+		stream.flushNotification();
+		pendingNotifications.removeFirstMatchingValue (&r);
+		setInterest (&r, true, false);
+		stream.readerWaitingForRoom = true;
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (stream.buffer.getFreeSpace() > 0 && stream.readerWaitingForRoom.exchange (false))
+			setInterest (&r, true, true);
+		return false;
+	}
+	const auto wanted = (size_t) jmax (1, stream.readChunkSize.load());
+	if (chunkSize < wanted)
+	{
+		chunkSize = wanted;
+		chunk.malloc (chunkSize);
+	}
+	//never take more than the buffer has room for, so the reactor doesn't have to hold on to anything. The other
+	//overflow policies make room for a whole chunk
+	const auto requested = blockWhenFull ? jmin (wanted, freeSpace) : wanted;
+	const auto bytesread = ::read (r.descriptor, chunk, requested);
+	SerialPortStatistics::add (r.port->statistics.readCalls, 1);
+	if (bytesread > 0)
+	{
+		const auto receivedNanos = SerialPortInputStream::getTimestampNanos();
+		stream.countReceived ((int) bytesread);
+		if (! stream.deliverToListener (chunk, (int) bytesread, receivedNanos))
+		{
+			stream.recordReceiveTime (receivedNanos);
+			stream.storeChunk (chunk, (size_t) bytesread);
+			stream.chunkAdded (chunk, (int) bytesread);
+		}
+	}
+	else if (! (bytesread == -1 && (errno == EAGAIN || errno == EINTR)))
+	{
+		portFailed (r, "SerialPortReactor::serviceInput", "::read() returned " + String (bytesread) + ", errno: " + String (errno));
+		return true;
+	}
+	//a short read means the driver is empty, which is the end of a burst. After a full one there may be nothing more to
+	//come either, and no event to say so, so whatever is held back is left for the next pass to send when it's due
+	const bool shortRead = (size_t) jmax ((ssize_t) 0, bytesread) < requested;
+	if (shortRead ? stream.sendIdleNotification() >= 0 : stream.notificationPending)
+		pendingNotifications.addIfNotAlreadyThere (&r);
+	return true;
+}
+
+int SerialPortReactor::sendIdleNotifications()
+{
+	int timeoutMs = -1;
+	for (int i = pendingNotifications.size(); --i >= 0;)
+	{
+		auto* r = pendingNotifications.getUnchecked (i);
+		const auto due = r->input != nullptr ? r->input->sendIdleNotification() : -1;
+		if (due < 0)
+			pendingNotifications.remove (i);
+		else if (timeoutMs < 0 || due < timeoutMs)
+			timeoutMs = due;
+	}
+	return timeoutMs;
+}
+
+bool SerialPortReactor::serviceOutput (Registration& r)
+{
+	auto& stream = *r.output;
+	const uint8_t* block1;
+	const uint8_t* block2;
+	size_t size1, size2;
+	stream.buffer.getReadRegions (block1, size1, block2, size2);
+	if (size1 > 0)
+	{
+		struct iovec regions[2] = { { (void*) block1, size1 }, { (void*) block2, size2 } };
+		const auto byteswritten = ::writev (r.descriptor, regions, size2 > 0 ? 2 : 1);
+		r.port->statistics.countWriteCall (byteswritten);
+		if (byteswritten > 0)
+		{
+			stream.removeFromBuffer ((size_t) byteswritten);
+		}
+		else if (! (byteswritten == -1 && (errno == EAGAIN || errno == EINTR)))
+		{
+			portFailed (r, "SerialPortReactor::serviceOutput", "::writev() couldn't write anything, errno: " + String (errno));
+			return true;
+		}
+	}
+	if (stream.buffer.getNumReady() == 0)
+	{
+		//same handshake as the writer thread's, with the epoll interest standing in for the sleep
+		setInterest (&r, false, false);
+		stream.writerWaiting = true;
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (stream.buffer.getNumReady() > 0 && stream.writerWaiting.exchange (false))
+			setInterest (&r, false, true);
+	}
+	return size1 > 0;
+}
+
+void SerialPortReactor::run()
+{
+	epoll_event events[64];
+	while (! threadShouldExit())
+	{
+		int timeoutMs;
+		{
+			const ScopedLock sl (lock);
+			retired.clear();
+			timeoutMs = sendIdleNotifications();
+		}
+		const auto numEvents = epoll_wait (epollDescriptor, events, numElementsInArray (events), timeoutMs);
+		if (numEvents == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		const ScopedLock sl (lock);
+		for (int i = 0; i < numEvents; ++i)
+		{
+			auto* r = static_cast<Registration*> (events[i].data.ptr);
+			if (r == nullptr)
+			{
+				wakeup.clear();
+				continue;
+			}
+			if (r->detached || r->failed)
+				continue;
+			//a hang up or error is left to the read or write to report, so anything still in the driver is delivered first
+			const auto ready = events[i].events;
+			bool serviced = false;
+			if (r->input != nullptr && (ready & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+			{
+				SerialPortStatistics::add (r->port->statistics.readerWakeups, 1);
+				serviced = serviceInput (*r);
+			}
+			if (r->output != nullptr && ! r->failed && (ready & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0)
+				serviced = serviceOutput (*r) || serviced;
+			//epoll reports a hang up or error whatever the interest, so if neither side touched the port (an idle
+			//writer, or a reader blocked on a full buffer) it would come straight back on every epoll_wait()
+			if (! serviced && ! r->failed && (ready & (EPOLLHUP | EPOLLERR)) != 0)
+				portFailed (*r, "SerialPortReactor::run", "the port hung up or reported an error");
+		}
+	}
+}
+
+/////////////////////////////////
+// SerialPortEnumerator
+/////////////////////////////////
+SerialPortEnumerator::SerialPortEnumerator()
+{
+	inotifyDescriptor = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyDescriptor != -1)
+		inotify_add_watch (inotifyDescriptor, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+}
+
+SerialPortEnumerator::~SerialPortEnumerator()
+{
+	if (inotifyDescriptor != -1)
+		::close (inotifyDescriptor);
+}
+
+SerialPortEnumerator& SerialPortEnumerator::getShared()
+{
+	static SerialPortEnumerator shared;
+	return shared;
+}
+
+Array<SerialPortInfo> SerialPortEnumerator::getPorts()
+{
+	const ScopedLock sl (lock);
+	updateIfChanged();
+	return ports;
+}
+
+bool SerialPortEnumerator::findByPath (const String& path, SerialPortInfo& result)
+{
+	const ScopedLock sl (lock);
+	updateIfChanged();
+	if (! pathIndex.contains (path))
+		return false;
+	result = ports.getReference (pathIndex[path]);
+	return true;
+}
+
+bool SerialPortEnumerator::findBySerialNumber (const String& serialNumber, SerialPortInfo& result, int interfaceNumber)
+{
+	const ScopedLock sl (lock);
+	updateIfChanged();
+	const auto key = interfaceNumber < 0 ? serialNumber : serialNumber + "/" + String (interfaceNumber);
+	if (serialNumber.isEmpty() || ! serialNumberIndex.contains (key))
+		return false;
+	result = ports.getReference (serialNumberIndex[key]);
+	return true;
+}
+
+Array<SerialPortInfo> SerialPortEnumerator::findByVendorAndProduct (int vendorId, int productId)
+{
+	const ScopedLock sl (lock);
+	updateIfChanged();
+	Array<SerialPortInfo> found;
+	for (auto index : vendorProductIndex[((int64) vendorId << 16) | productId])
+		found.add (ports.getReference (index));
+	return found;
+}
+
+void SerialPortEnumerator::invalidate()
+{
+	const ScopedLock sl (lock);
+	stale = true;
+}
+
+void SerialPortEnumerator::updateIfChanged()
+{
+	//without inotify there's no knowing, so the list is made every time, as getSerialPortPaths() used to
+	if (inotifyDescriptor == -1)
+		stale = true;
+	alignas (inotify_event) char events[4096];
+	while (inotifyDescriptor != -1)
+	{
+		const auto length = ::read (inotifyDescriptor, events, sizeof (events));
+		if (length <= 0)
+			break;
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const auto* event = reinterpret_cast<const inotify_event*> (events + offset);
+			offset += (ssize_t) (sizeof (inotify_event) + event->len);
+			//events lost to a full queue, or a watch that has gone, could have been about anything
+			if ((event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) != 0)
+			{
+				stale = true;
+				continue;
+			}
+			//in /dev, only ttys and the serial directory matter. Anything in /dev/serial does
+			const bool inDev = event->wd != serialWatch && event->wd != byIdWatch;
+			if (! inDev || (event->len > 0 && (strncmp (event->name, "tty", 3) == 0 || strcmp (event->name, "serial") == 0)))
+				stale = true;
+		}
+	}
+	if (! stale)
+		return;
+	stale = false;
+	watchDirectories();
+	scan();
+}
+
+void SerialPortEnumerator::watchDirectories()
+{
+	if (inotifyDescriptor == -1)
+		return;
+	//adding a watch that's already there gives back the same one, and a directory that's gone takes its watch with it
+	serialWatch = inotify_add_watch (inotifyDescriptor, "/dev/serial", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+	byIdWatch = inotify_add_watch (inotifyDescriptor, "/dev/serial/by-id", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+}
+
+//walks up from the tty's device to the usb interface, and the usb device that has it, reading what they say
+static void addUsbDetails (SerialPortInfo& info)
+{
+	char resolvedPath[PATH_MAX];
+	if (realpath (("/sys/class/tty/" + info.name + "/device").getCharPointer(), resolvedPath) == nullptr)
+		return;
+	String directory (resolvedPath);
+	if (! directory.contains ("/usb"))
+		return;
+	for (int depth = 0; depth < 4; ++depth, directory = directory.upToLastOccurrenceOf ("/", false, false))
+	{
+		if (info.interfaceNumber == -1)
+		{
+			const auto interfaceNumber = readSysfsAttribute (directory + "/bInterfaceNumber");
+			if (interfaceNumber.isNotEmpty())
+				info.interfaceNumber = interfaceNumber.getHexValue32();
+		}
+		const auto vendorId = readSysfsAttribute (directory + "/idVendor");
+		if (vendorId.isNotEmpty())
+		{
+			info.vendorId = vendorId.getHexValue32();
+			info.productId = readSysfsAttribute (directory + "/idProduct").getHexValue32();
+			info.serialNumber = readSysfsAttribute (directory + "/serial");
+			info.manufacturer = readSysfsAttribute (directory + "/manufacturer");
+			info.product = readSysfsAttribute (directory + "/product");
+			return;
+		}
+	}
+}
+
+void SerialPortEnumerator::scan()
+{
+	++numScans;
+	ports.clearQuick();
+	pathIndex.clear();
+	serialNumberIndex.clear();
+	vendorProductIndex.clear();
+
+	//the by-id links, by the name of the tty each leads to
+	HashMap<String, String> byIdLinks;
+	if (DIR* byIdDirectory = opendir ("/dev/serial/by-id"))
+	{
+		while (const auto* entry = readdir (byIdDirectory))
+		{
+			if (entry->d_name[0] == '.')
+				continue;
+			const String linkPath ("/dev/serial/by-id/" + String (entry->d_name));
+			char target[512];
+			const auto targetLength = readlink (linkPath.getCharPointer(), target, sizeof (target) - 1);
+			if (targetLength <= 0)
+				continue;
+			target[targetLength] = 0;
+			byIdLinks.set (String (target).fromLastOccurrenceOf ("/", false, false), linkPath);
+		}
+		closedir (byIdDirectory);
+	}
+
+	DIR* ttyDirectory = opendir ("/sys/class/tty");
+	if (ttyDirectory == nullptr)
+	{
+		DBG ("SerialPortEnumerator::scan : can't open /sys/class/tty");
+		return;
+	}
+	while (const auto* entry = readdir (ttyDirectory))
+	{
+		const String deviceName (entry->d_name);
+		if (deviceName.startsWith ("."))
+			continue;
+		//only ttys with a driver behind them are serial ports, this skips the consoles and ptys
+		char driverPath[512];
+		const auto driverPathLength = readlink (("/sys/class/tty/" + deviceName + "/device/driver").getCharPointer(), driverPath, sizeof (driverPath) - 1);
+		if (driverPathLength <= 0)
+			continue;
+		driverPath[driverPathLength] = 0;
+		SerialPortInfo info;
+		info.name = deviceName;
+		info.path = "/dev/" + deviceName;
+		info.driver = String (driverPath).fromLastOccurrenceOf ("/", false, false);
+		//newer kernels put a serial core "port" device between the tty and the 8250 driver
+		if ((info.driver == "serial8250" || info.driver == "port") && ! isPresent8250Port (info.path))
+			continue;
+		info.byIdPath = byIdLinks[deviceName];
+		addUsbDetails (info);
+
+		const auto index = ports.size();
+		ports.add (info);
+		pathIndex.set (info.path, index);
+		if (info.byIdPath.isNotEmpty())
+			pathIndex.set (info.byIdPath, index);
+		if (info.serialNumber.isNotEmpty())
+		{
+			if (! serialNumberIndex.contains (info.serialNumber))
+				serialNumberIndex.set (info.serialNumber, index);
+			serialNumberIndex.set (info.serialNumber + "/" + String (info.interfaceNumber), index);
+		}
+		if (info.vendorId != -1)
+		{
+			const auto key = ((int64) info.vendorId << 16) | info.productId;
+			auto indexes = vendorProductIndex[key];
+			indexes.add (index);
+			vendorProductIndex.set (key, indexes);
+		}
+	}
+	closedir (ttyDirectory);
+}
+/////////////////////////////////
+// SerialPortMonitor
+/////////////////////////////////
+SerialPortMonitor::SerialPortMonitor (Listener& l, bool watchPseudoTerminals, SerialPortEnumerator& e)
+	: Thread ("SerialMonitorThread"), listener (l), enumerator (e)
+{
+	//group 1 has the kernel's own uevents, rather than udev's once it has dealt with them
+	netlinkDescriptor = socket (AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (netlinkDescriptor != -1)
+	{
+		sockaddr_nl address {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = 1;
+		if (bind (netlinkDescriptor, reinterpret_cast<sockaddr*> (&address), sizeof (address)) == -1)
+		{
+			::close (netlinkDescriptor);
+			netlinkDescriptor = -1;
+		}
+	}
+	if (netlinkDescriptor == -1 || watchPseudoTerminals)
+		inotifyDescriptor = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyDescriptor != -1)
+	{
+		if (netlinkDescriptor == -1)
+			devWatch = inotify_add_watch (inotifyDescriptor, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+		if (watchPseudoTerminals)
+			ptsWatch = inotify_add_watch (inotifyDescriptor, "/dev/pts", IN_CREATE | IN_DELETE);
+	}
+	knownPorts = enumerator.getPorts();
+	startThread();
+}
+
+SerialPortMonitor::~SerialPortMonitor()
+{
+	signalThreadShouldExit();
+	wakeup.signal();
+	waitForThreadToExit (5000);
+	if (netlinkDescriptor != -1)
+		::close (netlinkDescriptor);
+	if (inotifyDescriptor != -1)
+		::close (inotifyDescriptor);
+}
+
+void SerialPortMonitor::run()
+{
+	//poll() leaves out the descriptors that are -1
+	pollfd descriptors[] = { { wakeup.getDescriptor(), POLLIN, 0 }, { netlinkDescriptor, POLLIN, 0 }, { inotifyDescriptor, POLLIN, 0 } };
+	while (! threadShouldExit())
+	{
+		if (poll (descriptors, numElementsInArray (descriptors), -1) <= 0)
+			continue;
+		if ((descriptors[1].revents & POLLIN) != 0)
+			readUevents();
+		if ((descriptors[2].revents & POLLIN) != 0)
+			readInotifyEvents();
+	}
+}
+
+void SerialPortMonitor::readUevents()
+{
+	char message[8192];
+	for (;;)
+	{
+		sockaddr_nl sender {};
+		socklen_t senderLength = sizeof (sender);
+		const auto length = recvfrom (netlinkDescriptor, message, sizeof (message), 0, reinterpret_cast<sockaddr*> (&sender), &senderLength);
+		if (length < 0)
+		{
+			//the socket's buffer overflowed, and some events have been lost
+			if (errno == ENOBUFS)
+			{
+				resync();
+				continue;
+			}
+			return;
+		}
+		//anything not from the kernel itself is ignored
+		if (sender.nl_pid == 0)
+			handleUevent (message, (size_t) length);
+	}
+}
+
+void SerialPortMonitor::readInotifyEvents()
+{
+	alignas (inotify_event) char events[4096];
+	for (;;)
+	{
+		const auto length = ::read (inotifyDescriptor, events, sizeof (events));
+		if (length <= 0)
+			return;
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const auto* event = reinterpret_cast<const inotify_event*> (events + offset);
+			offset += (ssize_t) (sizeof (inotify_event) + event->len);
+			//some events were lost, so what changed has to be worked out
+			if ((event->mask & IN_Q_OVERFLOW) != 0)
+				resync();
+			if (event->len == 0)
+				continue;
+			const String name (event->name);
+			String portName;
+			if (event->wd == ptsWatch && name != "ptmx")
+				portName = "pts/" + name;
+			else if (event->wd == devWatch && name.startsWith ("tty"))
+				portName = name;
+			if (portName.isEmpty())
+				continue;
+			if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+				portAdded (portName);
+			else
+				portRemoved (portName);
+		}
+	}
+}
+
+void SerialPortMonitor::handleUevent (const char* message, size_t length)
+{
+	//a header line, such as add@/devices/..., then NUL terminated KEY=value fields
+	String action, subsystem, deviceName;
+	for (size_t offset = 0; offset < length;)
+	{
+		const auto* field = message + offset;
+		const auto fieldLength = strnlen (field, length - offset);
+		const auto text = String::fromUTF8 (field, (int) fieldLength);
+		if (text.startsWith ("ACTION="))
+			action = text.substring (7);
+		else if (text.startsWith ("SUBSYSTEM="))
+			subsystem = text.substring (10);
+		else if (text.startsWith ("DEVNAME="))
+			deviceName = text.substring (8);
+		offset += fieldLength + 1;
+	}
+	if (subsystem != "tty" || deviceName.isEmpty())
+		return;
+	if (action == "add")
+		portAdded (deviceName);
+	else if (action == "remove")
+		portRemoved (deviceName);
+}
+
+int SerialPortMonitor::findKnownPort (const String& name) const
+{
+	for (int i = 0; i < knownPorts.size(); ++i)
+		if (knownPorts.getReference (i).name == name)
+			return i;
+	return -1;
+}
+
+void SerialPortMonitor::portAdded (const String& name)
+{
+	SerialPortInfo info;
+	if (name.startsWith ("pts/"))
+	{
+		info.name = name;
+		info.path = "/dev/" + name;
+		info.driver = "pty";
+	}
+	//the enumerator's own watch may not have seen the device node yet, and ttys that aren't serial ports aren't in it
+	else
+	{
+		enumerator.invalidate();
+		if (! enumerator.findByPath ("/dev/" + name, info))
+			return;
+	}
+	const ScopedLock sl (lock);
+	if (findKnownPort (name) != -1)
+		return;
+	knownPorts.add (info);
+	listener.serialPortAdded (info);
+}
+
+void SerialPortMonitor::portRemoved (const String& name)
+{
+	const ScopedLock sl (lock);
+	const auto index = findKnownPort (name);
+	if (index == -1)
+		return;
+	const auto info = knownPorts.getReference (index);
+	knownPorts.remove (index);
+	listener.serialPortRemoved (info);
+}
+
+void SerialPortMonitor::resync()
+{
+	enumerator.invalidate();
+	const auto ports = enumerator.getPorts();
+	const ScopedLock sl (lock);
+	for (int i = knownPorts.size(); --i >= 0;)
+	{
+		const auto info = knownPorts.getReference (i);
+		//the enumerator doesn't list ptys, so those are looked for in /dev/pts
+		bool stillThere = info.driver == "pty" && access (info.path.getCharPointer(), F_OK) == 0;
+		for (auto& port : ports)
+			stillThere = stillThere || port.name == info.name;
+		if (! stillThere)
+		{
+			knownPorts.remove (i);
+			listener.serialPortRemoved (info);
+		}
+	}
+	for (auto& port : ports)
+	{
+		if (findKnownPort (port.name) == -1)
+		{
+			knownPorts.add (port);
+			listener.serialPortAdded (port);
+		}
+	}
+}
+
+#endif // JUCE_LINUX
@@ -15,8 +15,12 @@ using namespace juce;
 #define Component DUMMY_Component
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include <termios.h>
+#include <time.h>
 #include <IOKit/serial/IOSerialKeys.h>
 #include <IOKit/usb/IOUSBLib.h>
 #include <IOKit/IOBSD.h>
@@ -72,16 +76,52 @@ StringPairArray SerialPort::getSerialPortPaths()
 }
 bool SerialPort::exists()
 {
-	return (-1!=portDescriptor);
+	return (-1!=portDescriptor) || isVirtual();
+}
+int SerialPort::getNumBytesQueued()
+{
+	int numBytes = 0;
+	if (-1 == portDescriptor || ioctl(portDescriptor, TIOCOUTQ, &numBytes) == -1)
+		return -1;
+	return numBytes;
+}
+bool SerialPort::drain (int timeoutMs)
+{
+	//tcdrain() can't be given a timeout or be cancelled, so the driver's queue is watched until it's empty, sleeping
+	//for about as long as the rest of it takes to send. tcdrain() then only has the uart's fifo left to wait for
+	const auto deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+	struct termios options;
+	//the speeds are plain bit rates on the Mac
+	const auto bitsPerSecond = tcgetattr(portDescriptor, &options) == 0 ? jmax ((speed_t) 1, cfgetospeed(&options)) : (speed_t) 9600;
+	for (;;)
+	{
+		const int numBytes = getNumBytesQueued();
+		if (numBytes == -1 || canceled)
+			return false;
+		if (numBytes == 0)
+			break;
+		auto sleepMs = jmax (1, (int) ((juce::int64) numBytes * 10000 / (juce::int64) bitsPerSecond));
+		if (timeoutMs >= 0)
+		{
+			const auto remaining = (int) std::ceil (deadline - Time::getMillisecondCounterHiRes());
+			if (remaining <= 0)
+				return false;
+			sleepMs = jmin (sleepMs, remaining);
+		}
+		Thread::sleep (jmin (sleepMs, 100));
+	}
+	return tcdrain(portDescriptor) == 0;
 }
 void SerialPort::close()
 {
     DebugLog ("SerialPort::close", "closing port:" + portPath);
 
+	//only tells the stream threads to stop, it doesn't wait for them. They have either gone already, or this is one of
+	//them (or the reactor) closing a port that has hung up
+	cancel();
 	if(-1 != portDescriptor)
 	{
-		//wait for garbage to go? nah...
-		//tcdrain(portDescriptor);
+		//not drained here, as the port may already be gone. SerialPortOutputStream::drain() does that first if it's wanted
 		::close(portDescriptor);
 		portDescriptor = -1;
 	}
@@ -90,6 +130,8 @@ bool SerialPort::open(const String & portPath)
 {
 	this->portPath = portPath;
     DebugLog ("SerialPort::open", "opening port:" + this->portPath);
+	canceled = false;
+	cancelWakeup.clear();
 
     struct termios options;
 	portDescriptor = ::open(portPath.getCharPointer(), O_RDWR | O_NOCTTY | O_NONBLOCK);
@@ -103,13 +145,7 @@ bool SerialPort::open(const String & portPath)
     {
         DebugLog ("SerialPort::open", "ioctl error, non critical");
     }
-    // we want blocking io actually
-	if (fcntl(portDescriptor, F_SETFL, 0) == -1)
-    {
-        DebugLog ("SerialPort::open", "fcntl error");
-		close();
-        return false;
-    }
+    // the descriptor is left non-blocking, the stream threads wait on it with poll() so they can be cancelled at any time
 	// Get the current options
     if (tcgetattr(portDescriptor, &options) == -1)
     {
@@ -117,10 +153,11 @@ bool SerialPort::open(const String & portPath)
 		close();
         return false;
     }
-	//non canocal, 0.5 second timeout, read returns as soon as any data is recieved
+	//non canocal, no timeout. with VMIN of 1 a read with nothing to return fails with EAGAIN,
+	//and a return of 0 only ever means the tty has gone away
 	cfmakeraw(&options);
-    options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 5;
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
 	if (tcsetattr(portDescriptor, TCSANOW, &options) == -1)
     {
         DebugLog ("SerialPort::open", "can't set port settings (timeouts)");
@@ -131,17 +168,23 @@ bool SerialPort::open(const String & portPath)
 }
 void SerialPort::cancel ()
 {
+	canceled = true;
+	cancelWakeup.signal();
 }
 
+bool SerialPort::openWithConfig(const String & portPath, const SerialPortConfig & config)
+{
+	return open (portPath) && setConfig (config);
+}
 bool SerialPort::setConfig(const SerialPortConfig & config)
 {
 	if(-1==portDescriptor)return false;
 	struct termios options;
 	memset(&options, 0, sizeof(struct termios));
-	//non canocal, 0.5 second timeout, read returns as soon as any data is recieved
+	//non canocal, no timeout, see open()
 	cfmakeraw(&options);
-    options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 5;
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
 	options.c_cflag |= CREAD; //enable reciever (daft)
 	options.c_cflag |= CLOCAL;//don't monitor modem control lines
 	//baud and bits
@@ -201,13 +244,18 @@ bool SerialPort::setConfig(const SerialPortConfig & config)
         DebugLog("SerialPort::setConfig", "can't set port settings");
         return false;
     }
-    
-    int new_baud = static_cast<int> (config.bps);
-    if (ioctl (portDescriptor, _IOW('T', 2, speed_t), &new_baud, 1) == -1) {
-        DebugLog ("SerialPort::setConfig", "can't set baud rate");
-        return false;
-    }
-    
+	return setBaudRate (config.bps);
+}
+bool SerialPort::setBaudRate (juce::uint32 bitsPerSecond)
+{
+	if(-1==portDescriptor)return false;
+	//IOSSIOSPEED takes any rate the driver can make, which cfsetspeed() won't
+	speed_t speed = bitsPerSecond;
+	if (ioctl (portDescriptor, IOSSIOSPEED, &speed) == -1)
+	{
+		DebugLog ("SerialPort::setBaudRate", "can't set baud rate");
+		return false;
+	}
 	return true;
 }
 bool SerialPort::getConfig(SerialPortConfig & config)
@@ -245,35 +293,104 @@ bool SerialPort::getConfig(SerialPortConfig & config)
 	
 	return true;
 }
+/////////////////////////////////
+// SerialPortWakeup
+/////////////////////////////////
+SerialPortWakeup::SerialPortWakeup()
+{
+	int descriptors[2] = { -1, -1 };
+	if (pipe (descriptors) == 0)
+	{
+		for (auto descriptor : descriptors)
+		{
+			fcntl (descriptor, F_SETFL, O_NONBLOCK);
+			fcntl (descriptor, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	readDescriptor = descriptors[0];
+	writeDescriptor = descriptors[1];
+}
+
+SerialPortWakeup::~SerialPortWakeup()
+{
+	if (readDescriptor != -1)
+		::close (readDescriptor);
+	if (writeDescriptor != -1)
+		::close (writeDescriptor);
+}
+
+void SerialPortWakeup::signal()
+{
+	const char one = 1;
+	const auto result = ::write (writeDescriptor, &one, 1);
+	ignoreUnused (result);
+}
+
+void SerialPortWakeup::clear()
+{
+	char drain[64];
+	while (::read (readDescriptor, drain, sizeof (drain)) > 0) {}
+}
+
+//waits for the port to be ready for portEvents (or only for the wakeups, if portEvents is 0). A stream wakeup or a timeout
+//returns true, as the caller checks threadShouldExit() anyway. returns false if the port has been cancelled
+static bool pollPort (int portDescriptor, short portEvents, SerialPortWakeup& streamWakeup, const SerialPortWakeup& portWakeup, int timeoutMs = -1)
+{
+	pollfd descriptors[3] = { { streamWakeup.getDescriptor(), POLLIN, 0 }, { portWakeup.getDescriptor(), POLLIN, 0 }, { portDescriptor, portEvents, 0 } };
+	while (poll (descriptors, portEvents != 0 ? 3 : 2, timeoutMs) == -1)
+		if (errno != EINTR)
+			return false;
+	if (descriptors[1].revents != 0)
+		return false;
+	if (descriptors[0].revents != 0)
+		streamWakeup.clear();
+	return true;
+}
+
 /////////////////////////////////
 // SerialPortInputStream
 /////////////////////////////////
+int64 SerialPortInputStream::getTimestampNanos()
+{
+	return (int64) clock_gettime_nsec_np (CLOCK_MONOTONIC_RAW);
+}
+
 void SerialPortInputStream::cancel ()
 {
+	signalThreadShouldExit();
+	wakeup.signal();
 }
 
 void SerialPortInputStream::run()
 {
     //port->DebugLog ("SerialPortInputStream::run", "starting thread");
 
+    HeapBlock<unsigned char> chunk;
+    int chunkSize = 0;
     while (port != nullptr && port->portDescriptor != -1 && ! threadShouldExit ())
     {
-        unsigned char c;
-        //this call will block until we read 1 byte, or ::read() returns an error, caught below
-        const auto bytesread = ::read (port->portDescriptor, &c, 1);
-        if (bytesread == 1)
+        if (chunkSize != readChunkSize)
         {
-            const ScopedLock l (bufferCriticalSection);
-
-            buffer.ensureSize (bufferedbytes + 1);
-            buffer[bufferedbytes] = c;
-            ++bufferedbytes;
-
-            if (notify == NOTIFY_ALWAYS || (notify == NOTIFY_ON_CHAR && c == notifyChar))
-                sendChangeMessage();
+            chunkSize = readChunkSize;
+            chunk.malloc (chunkSize);
         }
-        else if (bytesread == -1 && errno != EAGAIN)
+        //take everything the driver has in one go, and sleep in poll() when there is nothing
+        const auto bytesread = ::read (port->portDescriptor, chunk, chunkSize);
+        SerialPortStatistics::add (port->statistics.readCalls, 1);
+        if (bytesread > 0)
         {
+            addToBuffer (chunk, (int) bytesread, getTimestampNanos());
+        }
+        else if (bytesread == -1 && (errno == EAGAIN || errno == EINTR))
+        {
+            //the driver is empty, which is the end of a burst
+            if (! pollPort (port->portDescriptor, POLLIN, wakeup, port->cancelWakeup, sendIdleNotification()))
+                break;
+            SerialPortStatistics::add (port->statistics.readerWakeups, 1);
+        }
+        else
+        {
+            //a return of 0 means the tty has been hung up
             port->DebugLog ("SerialPortInputStream::run", "::read() returned " + String(bytesread) + ", errno: " + String (errno));
             port->close ();
             break;
@@ -281,23 +398,13 @@ void SerialPortInputStream::run()
     }
 
     //port->DebugLog ("SerialPortInputStream::run", "stopping thread");
+	stoppedServicing();
 }
 
 int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 {
-    if (port != nullptr && port->portDescriptor != -1)
-    {
-        const ScopedLock l (bufferCriticalSection);
-
-        if (maxBytesToRead > bufferedbytes)
-            maxBytesToRead = bufferedbytes;
-
-        memcpy (destBuffer, buffer.getData(), maxBytesToRead);
-        buffer.removeSection (0,maxBytesToRead);
-        bufferedbytes -= maxBytesToRead;
-
-        return maxBytesToRead;
-    }
+    if (port != nullptr && (port->portDescriptor != -1 || port->isVirtual()))
+        return readFromBuffer (destBuffer, maxBytesToRead);
     else
         return -1;
 }
@@ -306,30 +413,52 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 /////////////////////////////////
 void SerialPortOutputStream::cancel ()
 {
+	signalThreadShouldExit();
+	wakeup.signal();
+}
+
+void SerialPortOutputStream::triggerWriter()
+{
+	wakeup.signal();
+}
+
+bool SerialPortOutputStream::waitForTrigger()
+{
+	return pollPort (port->portDescriptor, 0, wakeup, port->cancelWakeup);
 }
 
 void SerialPortOutputStream::run()
 {
     //port->DebugLog ("SerialPortOutputStream::run", "starting thread");
 
-    unsigned char tempbuffer[writeBufferSize];
     while(port && (port->portDescriptor!=-1) && !threadShouldExit())
     {
-		// todo - there are two reads of 'bufferedbytes' which are outside of a mutex, should it be atomic at the minimum
-        if (! bufferedbytes)
-            triggerWrite.wait(100);
-        if (bufferedbytes)
+        makeRequestedRoom();
+        if (buffer.getNumReady() == 0)
         {
-            bufferCriticalSection.enter();
-            int bytestowrite = bufferedbytes > writeBufferSize ? writeBufferSize : bufferedbytes;
-            memcpy (tempbuffer, buffer.getData(), bytestowrite);
-            bufferCriticalSection.exit();
-            const auto byteswritten = ::write(port->portDescriptor, tempbuffer, bytestowrite);
+            if (! waitForSomethingToWrite())
+                break;
+            continue;
+        }
+        //send straight out of the queue, both regions in one call if it has wrapped around
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t size1, size2;
+        buffer.getReadRegions (block1, size1, block2, size2);
+        if (size1 > 0)
+        {
+            struct iovec regions[2] = { { (void*) block1, size1 }, { (void*) block2, size2 } };
+            const auto byteswritten = ::writev(port->portDescriptor, regions, size2 > 0 ? 2 : 1);
+            port->statistics.countWriteCall (byteswritten);
             if (byteswritten>0)
             {
-                const ScopedLock l(bufferCriticalSection);
-                buffer.removeSection(0, byteswritten);
-                bufferedbytes-=byteswritten;
+                removeFromBuffer ((size_t) byteswritten);
+            }
+            else if (byteswritten == -1 && (errno == EAGAIN || errno == EINTR))
+            {
+                //the driver's queue is full, wait for room rather than spinning
+                if (! pollPort (port->portDescriptor, POLLOUT, wakeup, port->cancelWakeup))
+                    break;
             }
             else
             {
@@ -340,16 +469,19 @@ void SerialPortOutputStream::run()
         }
     }
     //port->DebugLog ("SerialPortOutputStream::run", "stopping thread");
+	stoppedServicing();
 }
 
 bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
 {
-	bufferCriticalSection.enter();
-    buffer.append(dataToWrite, howManyBytes);
-	bufferedbytes+=howManyBytes;
-	bufferCriticalSection.exit();
-	triggerWrite.signal();
-	return true;
+	return writeSome (dataToWrite, howManyBytes) == howManyBytes;
+}
+
+size_t SerialPortOutputStream::writeSome (const void* dataToWrite, size_t howManyBytes)
+{
+	if (port->isVirtual())
+		return sendToVirtualPair (dataToWrite, howManyBytes);
+	return addToBuffer (dataToWrite, howManyBytes);
 }
 
 #endif // JUCE_MAC
@@ -0,0 +1,372 @@
+//juce_serialport_VirtualPair.cpp
+//SerialPortVirtualPair, which is the same on every platform, so this is built for all of them
+//see juce_serialport.h for details
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include <math.h>
+#include <string.h>
+#include "juce_serialport.h"
+
+/////////////////////////////////
+// SerialPortVirtualPair::Line
+/////////////////////////////////
+//one direction of a virtual pair. Data that doesn't have to wait goes straight across on the sender's thread. When the
+//line is paced or delayed, it is queued with the time it was sent, and the line's own thread hands each byte over when
+//it would have arrived
+class SerialPortVirtualPair::Line : private Thread
+{
+public:
+	explicit Line (SerialPort& senderPort) : Thread ("SerialVirtualLine"), sender (senderPort), queue (1 << 16)
+	{
+		chunk.malloc (queue.getCapacity());
+		startThread();
+	}
+	~Line()
+	{
+		signalThreadShouldExit();
+		dataQueued.signal();
+		roomAvailable.signal();
+		queueEmpty.signal();
+		waitForThreadToExit (5000);
+	}
+
+	void setConditions (const LineConditions& newConditions)
+	{
+		{
+			const SpinLock::ScopedLockType sl (conditionsLock);
+			conditions = newConditions;
+			++conditionsVersion;
+		}
+		dataQueued.signal();
+	}
+
+	LineConditions getConditions (int& version) const
+	{
+		const SpinLock::ScopedLockType sl (conditionsLock);
+		version = conditionsVersion;
+		return conditions;
+	}
+
+	void attach (SerialPortInputStream* input)
+	{
+		const ScopedLock sl (receiverLock);
+		jassert (receiver == nullptr);
+		receiver = input;
+	}
+
+	//once this returns the line won't touch the stream again
+	void detach (SerialPortInputStream* input)
+	{
+		const ScopedLock sl (receiverLock);
+		if (receiver == input)
+			receiver = nullptr;
+	}
+
+	//called by the sending end's write(). The lock only serialises callers, the line's thread never takes it
+	//returns how many bytes were sent, which is less than numBytes only if the line is going away
+	size_t send (const void* data, size_t numBytes)
+	{
+		const ScopedLock sl (sendLock);
+		const auto numToSend = numBytes;
+		sender.statistics.countWriteCall ((long) numBytes);
+		SerialPortStatistics::add (bytesSent, numBytes);
+		auto* source = static_cast<const uint8_t*> (data);
+		int version;
+		const auto current = getConditions (version);
+		//anything still queued has to arrive first
+		if (current.bitsPerSecond == 0 && current.delayMicroseconds <= 0 && queue.getNumReady() == 0)
+		{
+			deliver (source, numBytes, SerialPortInputStream::getTimestampNanos());
+			return numBytes;
+		}
+		const auto sentNanos = SerialPortInputStream::getTimestampNanos();
+		while (numBytes > 0)
+		{
+			const auto index = numRecordsWritten.load (std::memory_order_relaxed);
+			const auto numToQueue = index - recordsReadIndex.load (std::memory_order_acquire) < numRecords
+			                      ? jmin (numBytes, queue.getFreeSpace()) : 0;
+			if (numToQueue > 0)
+			{
+				//the record goes first, so the line's thread never sees bytes without their time
+				records[index & recordsMask] = { queue.getWritePosition() + numToQueue, sentNanos };
+				numRecordsWritten.store (index + 1, std::memory_order_release);
+				queue.write (source, numToQueue);
+				dataQueued.signal();
+				source += numToQueue;
+				numBytes -= numToQueue;
+			}
+			else if (threadShouldExit())
+				return numToSend - numBytes;
+			else
+				roomAvailable.wait();
+		}
+		return numToSend;
+	}
+
+	size_t getNumBytesInFlight() const { return queue.getNumReady(); }
+
+	bool drain (int timeoutMs)
+	{
+		const auto deadline = timeoutMs < 0 ? -1.0 : Time::getMillisecondCounterHiRes() + timeoutMs;
+		while (queue.getNumReady() > 0)
+		{
+			int waitMs = -1;
+			if (deadline >= 0)
+			{
+				waitMs = (int) std::ceil (deadline - Time::getMillisecondCounterHiRes());
+				if (waitMs <= 0)
+					return false;
+			}
+			if (threadShouldExit())
+				return false;
+			queueEmpty.wait (waitMs);
+		}
+		return true;
+	}
+
+	LineCounts getCounts() const
+	{
+		LineCounts c;
+		c.bytesSent = bytesSent;
+		c.bytesDelivered = bytesDelivered;
+		c.parityErrors = parityErrors;
+		c.overruns = overruns;
+		c.bytesLost = bytesLost;
+		c.bytesUnheard = bytesUnheard;
+		return c;
+	}
+
+	void run() override
+	{
+		while (! threadShouldExit())
+		{
+			int waitMs = -1;
+			const auto numWritten = numRecordsWritten.load (std::memory_order_acquire);
+			const auto position = queue.getReadPosition();
+			auto index = recordsReadIndex.load (std::memory_order_relaxed);
+			while (index < numWritten && records[index & recordsMask].endPosition <= position)
+				++index;
+			recordsReadIndex.store (index, std::memory_order_release);
+
+			if (index < numWritten)
+			{
+				//the bytes of the oldest write still on the way leave one after another, once the line is free and
+				//they have been sent, and arrive delayMicroseconds after they left
+				const auto& record = records[index & recordsMask];
+				const auto available = jmin (record.endPosition, queue.getWritePosition()) - position;
+				int version;
+				const auto current = getConditions (version);
+				const int64 byteNanos = current.bitsPerSecond > 0
+				                            ? (int64) current.bitsPerByte * 1000000000 / current.bitsPerSecond : 0;
+				const auto departure = jmax (lineFreeNanos, record.sentNanos);
+				const auto elapsed = SerialPortInputStream::getTimestampNanos() - departure - (int64) current.delayMicroseconds * 1000;
+				size_t numArrived = 0;
+				if (elapsed >= 0)
+					numArrived = byteNanos > 0 ? (size_t) jmin ((int64) available, elapsed / byteNanos) : available;
+				if (numArrived > 0)
+				{
+					queue.peek (chunk, numArrived);
+					lineFreeNanos = departure + (int64) numArrived * byteNanos;
+					deliver (chunk, numArrived, lineFreeNanos + (int64) current.delayMicroseconds * 1000);
+					queue.skip (numArrived);
+					roomAvailable.signal();
+					if (queue.getNumReady() == 0)
+						queueEmpty.signal();
+					continue;
+				}
+				//sleeps until the next byte arrives, or a byte that has only just been queued is there
+				waitMs = available > 0 ? (int) jlimit ((int64) 1, (int64) 100, (byteNanos - elapsed + 999999) / 1000000) : 1;
+			}
+			else
+			{
+				const ScopedLock sl (receiverLock);
+				if (receiver != nullptr)
+					waitMs = receiver->sendIdleNotification();
+			}
+			dataQueued.wait (waitMs);
+		}
+	}
+
+private:
+	//hands data over to the far end's input stream, as the driver thread of a real port would. Called with the sender's
+	//lock held, or by the line's thread, so it's only ever on one thread at a time
+	void deliver (const uint8_t* data, size_t numBytes, int64 arrivedNanos)
+	{
+		const ScopedLock sl (receiverLock);
+		int version;
+		const auto current = getConditions (version);
+		if (version != errorsVersion)
+		{
+			errorsVersion = version;
+			random.setSeed (current.seed);
+			bytesUntilError = -1;
+		}
+		const auto errorRate = current.parityErrorRate + current.overrunRate + current.dropRate;
+		while (numBytes > 0)
+		{
+			const auto* source = data;
+			auto numSource = numBytes;
+			auto numKept = numBytes;
+			if (errorRate > 0.0)
+			{
+				numSource = jmin (numBytes, queue.getCapacity());
+				numKept = applyErrors (current, errorRate, data, numSource);
+				source = chunkWithErrors;
+			}
+			data += numSource;
+			numBytes -= numSource;
+			if (numKept == 0)
+				continue;
+			if (receiver == nullptr)
+			{
+				SerialPortStatistics::add (bytesUnheard, numKept);
+				continue;
+			}
+			SerialPortStatistics::add (bytesDelivered, numKept);
+			//addToBuffer() counts in ints
+			for (size_t done = 0; done < numKept;)
+			{
+				const auto n = (int) jmin (numKept - done, (size_t) 1 << 30);
+				receiver->addToBuffer (source + done, n, arrivedNanos);
+				done += (size_t) n;
+			}
+		}
+		//a change message that has to be held back is sent by the line's thread when it is due
+		if (receiver != nullptr && receiver->sendIdleNotification() >= 0)
+			dataQueued.signal();
+	}
+
+	//copies numBytes from source into chunkWithErrors, hitting them with errors, and returns how many are left. The gaps
+	//between errors are drawn from the geometric distribution, so a clean stretch costs no more than a memcpy
+	size_t applyErrors (const LineConditions& current, double errorRate, const uint8_t* source, size_t numBytes)
+	{
+		if (chunkWithErrorsSize < numBytes)
+		{
+			chunkWithErrors.realloc (numBytes);
+			chunkWithErrorsSize = numBytes;
+		}
+		auto* dest = chunkWithErrors.get();
+		size_t in = 0, out = 0;
+		while (in < numBytes)
+		{
+			if (bytesUntilError < 0)
+			{
+				bytesUntilError = 0;
+				if (errorRate < 1.0)
+				{
+					const auto gap = std::floor (std::log (1.0 - random.nextDouble()) / std::log (1.0 - errorRate));
+					bytesUntilError = gap < 1e15 ? (int64) gap : ((int64) 1 << 50);
+				}
+			}
+			const auto numClean = (size_t) jmin ((int64) (numBytes - in), bytesUntilError);
+			memcpy (dest + out, source + in, numClean);
+			in += numClean;
+			out += numClean;
+			bytesUntilError -= (int64) numClean;
+			if (in == numBytes)
+				break;
+			bytesUntilError = -1;
+			const auto which = random.nextDouble() * errorRate;
+			if (which < current.parityErrorRate)
+			{
+				dest[out++] = (uint8_t) (source[in++] ^ (1 << random.nextInt (8)));
+				SerialPortStatistics::add (parityErrors, 1);
+			}
+			else
+			{
+				size_t numLost = 1;
+				if (which < current.parityErrorRate + current.overrunRate)
+				{
+					numLost = jmin (numBytes - in, (size_t) jmax (1, current.overrunLength));
+					SerialPortStatistics::add (overruns, 1);
+				}
+				in += numLost;
+				SerialPortStatistics::add (bytesLost, numLost);
+			}
+		}
+		return out;
+	}
+
+	SerialPort& sender;
+	CriticalSection sendLock;
+	//held while data is handed to the receiver, so detach() waits for that to finish
+	CriticalSection receiverLock;
+	SerialPortInputStream* receiver = nullptr;
+	mutable SpinLock conditionsLock;
+	LineConditions conditions;
+	int conditionsVersion = 0;
+	//the error state, only touched in deliver()
+	int errorsVersion = -1;
+	Random random;
+	int64 bytesUntilError = -1;
+	HeapBlock<uint8_t> chunkWithErrors;
+	size_t chunkWithErrorsSize = 0;
+	//what is on the way when the line is paced or delayed, and the sender's position just past each write, with when it
+	//was sent. Written by the sender, and read by the line's thread
+	SerialPortRingBuffer queue;
+	struct SendRecord
+	{
+		size_t endPosition;
+		int64 sentNanos;
+	};
+	static const size_t numRecords = 1024;
+	static const size_t recordsMask = numRecords - 1;
+	SendRecord records[numRecords];
+	std::atomic<size_t> numRecordsWritten { 0 };
+	std::atomic<size_t> recordsReadIndex { 0 };
+	WaitableEvent dataQueued, roomAvailable, queueEmpty;
+	//only used by the line's thread: when the last byte it let go of finished leaving, and where it copies bytes out to
+	int64 lineFreeNanos = 0;
+	HeapBlock<uint8_t> chunk;
+	std::atomic<uint64> bytesSent { 0 }, bytesDelivered { 0 }, parityErrors { 0 }, overruns { 0 }, bytesLost { 0 }, bytesUnheard { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE (Line)
+};
+
+/////////////////////////////////
+// SerialPortVirtualPair
+/////////////////////////////////
+SerialPortVirtualPair::SerialPortVirtualPair()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		ends[i].reset (new SerialPort (nullptr));
+		ends[i]->virtualPair = this;
+		ends[i]->virtualEnd = i;
+		ends[i]->portPath = "virtual" + String (i);
+		lines[i].reset (new Line (*ends[i]));
+	}
+}
+
+SerialPortVirtualPair::~SerialPortVirtualPair()
+{
+	for (auto& line : lines)
+		line = nullptr;
+	for (auto& end : ends)
+		end = nullptr;
+}
+
+void SerialPortVirtualPair::setLineConditions (int from, const LineConditions& conditions) { lines[from & 1]->setConditions (conditions); }
+SerialPortVirtualPair::LineCounts SerialPortVirtualPair::getLineCounts (int from) const { return lines[from & 1]->getCounts(); }
+size_t SerialPortVirtualPair::getNumBytesInFlight (int from) const { return lines[from & 1]->getNumBytesInFlight(); }
+bool SerialPortVirtualPair::drain (int from, int timeoutMs) { return lines[from & 1]->drain (timeoutMs); }
+
+/////////////////////////////////
+// the streams' hooks
+/////////////////////////////////
+void SerialPortInputStream::attachToVirtualPair() { port->virtualPair->lines[1 - port->virtualEnd]->attach (this); }
+void SerialPortInputStream::detachFromVirtualPair() { port->virtualPair->lines[1 - port->virtualEnd]->detach (this); }
+
+size_t SerialPortOutputStream::sendToVirtualPair (const void* dataToWrite, size_t howManyBytes)
+{
+	return port->virtualPair->lines[port->virtualEnd]->send (dataToWrite, howManyBytes);
+}
+
+bool SerialPortOutputStream::drainVirtualPair (int timeoutMs)
+{
+	return port->virtualPair->drain (port->virtualEnd, timeoutMs);
+}
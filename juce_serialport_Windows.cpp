@@ -127,7 +127,43 @@ void SerialPort::close()
 }
 bool SerialPort::exists()
 {
-    return portHandle ? true : false;
+    return portHandle || isVirtual();
+}
+
+int SerialPort::getNumBytesQueued()
+{
+    DWORD errors = 0;
+    COMSTAT status;
+    if (!portHandle || !ClearCommError (portHandle, &errors, &status))
+        return -1;
+    return (int) status.cbOutQue;
+}
+
+bool SerialPort::drain (int timeoutMs)
+{
+    //FlushFileBuffers() can't be given a timeout, so the driver's queue is watched until it's empty, sleeping for about
+    //as long as the rest of it takes to send
+    const auto deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+    DCB dcb;
+    dcb.DCBlength = sizeof (dcb);
+    const auto bitsPerSecond = portHandle && GetCommState (portHandle, &dcb) ? jmax ((DWORD) 1, dcb.BaudRate) : (DWORD) 9600;
+    for (;;)
+    {
+        const int numBytes = getNumBytesQueued();
+        if (numBytes == -1 || canceled)
+            return false;
+        if (numBytes == 0)
+            return true;
+        auto sleepMs = jmax (1, (int) ((juce::int64) numBytes * 10000 / (juce::int64) bitsPerSecond));
+        if (timeoutMs >= 0)
+        {
+            const auto remaining = (int) std::ceil (deadline - Time::getMillisecondCounterHiRes());
+            if (remaining <= 0)
+                return false;
+            sleepMs = jmin (sleepMs, remaining);
+        }
+        Thread::sleep (jmin (sleepMs, 100));
+    }
 }
 
 bool SerialPort::open (const String & newPortPath)
@@ -170,6 +206,10 @@ void SerialPort::cancel ()
 //            const auto result = CancelIoEx (portHandle, nullptr);
     }
 }
+bool SerialPort::openWithConfig(const String & portPath, const SerialPortConfig & config)
+{
+    return open (portPath) && setConfig (config);
+}
 bool SerialPort::setConfig(const SerialPortConfig & config)
 {
     if (!portHandle)return false;
@@ -246,6 +286,15 @@ bool SerialPort::setConfig(const SerialPortConfig & config)
     return (SetCommState(portHandle, &dcb) ? true : false);
 }
 
+bool SerialPort::setBaudRate (juce::uint32 bitsPerSecond)
+{
+    if (!portHandle)return false;
+    DCB dcb;
+    if (!GetCommState(portHandle, &dcb))
+        return false;
+    dcb.BaudRate = bitsPerSecond;
+    return (SetCommState(portHandle, &dcb) ? true : false);
+}
 bool SerialPort::getConfig(SerialPortConfig & config)
 {
     if (!portHandle)return false;
@@ -298,6 +347,20 @@ bool SerialPort::getConfig(SerialPortConfig & config)
 /////////////////////////////////
 // SerialPortInputStream
 /////////////////////////////////
+int64 SerialPortInputStream::getTimestampNanos()
+{
+    static const auto ticksPerSecond = []
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency (&frequency);
+        return (int64) frequency.QuadPart;
+    }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter (&now);
+    //split up so the multiplication can't overflow
+    return (now.QuadPart / ticksPerSecond) * 1000000000 + (now.QuadPart % ticksPerSecond) * 1000000000 / ticksPerSecond;
+}
+
 void SerialPortInputStream::run()
 {
     //port->DebugLog ("SerialPortInputStream::run", "starting");
@@ -307,6 +370,8 @@ void SerialPortInputStream::run()
     memset(&ov, 0, sizeof(ov));
     ov.hEvent = CreateEvent(0, true, 0, 0);
     bool ioPending = false;
+    HeapBlock<unsigned char> chunk;
+    int chunkSize = 0;
     //overlapped structure for the read
     while (port && port->portHandle && !threadShouldExit())
     {
@@ -324,8 +389,11 @@ void SerialPortInputStream::run()
         }
 
         ioPending = true;
-        if (/*(dwEventMask & EV_RXCHAR) && */WAIT_OBJECT_0 == WaitForSingleObject(ov.hEvent, 100))
+        //wake up in time to send a change message that has been held back at the end of a burst
+        const int notifyTimeout = sendIdleNotification();
+        if (/*(dwEventMask & EV_RXCHAR) && */WAIT_OBJECT_0 == WaitForSingleObject(ov.hEvent, notifyTimeout >= 0 ? (DWORD) jmin (notifyTimeout, 100) : 100))
         {
+            SerialPortStatistics::add (port->statistics.readerWakeups, 1);
             DWORD dwMask;
             if (GetCommMask(port->portHandle, &dwMask))
             {
@@ -337,20 +405,19 @@ void SerialPortInputStream::run()
                     DWORD bytesread = 0;
                     do
                     {
-                        unsigned char c;
+                        if (chunkSize != readChunkSize)
+                        {
+                            chunkSize = readChunkSize;
+                            chunk.malloc (chunkSize);
+                        }
+                        //ReadIntervalTimeout is MAXDWORD, so this returns straight away with whatever has been received
                         ResetEvent(ovRead.hEvent);
-                        ReadFile(port->portHandle, &c, 1, &bytesread, &ovRead);
+                        ReadFile(port->portHandle, chunk, (DWORD) chunkSize, &bytesread, &ovRead);
+                        SerialPortStatistics::add (port->statistics.readCalls, 1);
                         if (GetLastError () != ERROR_SUCCESS)
                             port->DebugLog("SerialPortInputStream::run", "[getLastError:" + String (GetLastError ()) + "]");
-                        if (bytesread == 1)
-                        {
-                            const ScopedLock l(bufferCriticalSection);
-                            buffer.ensureSize(bufferedbytes + 1);
-                            buffer[bufferedbytes] = c;
-                            bufferedbytes++;
-                            if (notify == NOTIFY_ALWAYS || ((notify == NOTIFY_ON_CHAR) && (c == notifyChar)))
-                                sendChangeMessage();
-                        }
+                        if (bytesread > 0)
+                            addToBuffer (chunk, (int) bytesread);
                     } while (bytesread);
                 }
                 CloseHandle (ovRead.hEvent);
@@ -361,6 +428,7 @@ void SerialPortInputStream::run()
     }
     CloseHandle(ov.hEvent);
     //port->DebugLog ("SerialPortInputStream::run", "exiting");
+    stoppedServicing();
 }
 
 void SerialPortInputStream::cancel ()
@@ -373,15 +441,10 @@ void SerialPortInputStream::cancel ()
 
 int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 {
-    if (!port || port->portHandle == 0)
+    if (!port || (port->portHandle == 0 && ! port->isVirtual()))
         return -1;
 
-    const ScopedLock l (bufferCriticalSection);
-    if (maxBytesToRead > bufferedbytes)maxBytesToRead = bufferedbytes;
-    memcpy (destBuffer, buffer.getData (), maxBytesToRead);
-    buffer.removeSection (0, maxBytesToRead);
-    bufferedbytes -= maxBytesToRead;
-    return maxBytesToRead;
+    return readFromBuffer (destBuffer, maxBytesToRead);
 }
 
 /////////////////////////////////
@@ -390,23 +453,28 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 void SerialPortOutputStream::run()
 {
     //port->DebugLog ("SerialPortOutputStream::run", "starting");
-    unsigned char tempbuffer[writeBufferSize];
     OVERLAPPED ov;
     memset(&ov, 0, sizeof(ov));
     ov.hEvent = CreateEvent(0, true, 0, 0);
     while (port && port->portHandle && !threadShouldExit())
     {
-        if (!bufferedbytes)
-            triggerWrite.wait(100);
-        if (bufferedbytes)
+        makeRequestedRoom();
+        if (buffer.getNumReady() == 0)
+        {
+            if (! waitForSomethingToWrite())
+                break;
+            continue;
+        }
+        //send straight out of the queue, the second region (if it has wrapped around) goes next time round
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t size1, size2;
+        buffer.getReadRegions (block1, size1, block2, size2);
+        if (size1 > 0)
         {
             DWORD byteswritten = 0;
-            bufferCriticalSection.enter ();
-            DWORD bytestowrite = bufferedbytes > writeBufferSize ? writeBufferSize : bufferedbytes;
-            memcpy (tempbuffer, buffer.getData (), bytestowrite);
-            bufferCriticalSection.exit ();
             ResetEvent (ov.hEvent);
-            int iRet = WriteFile (port->portHandle, tempbuffer, bytestowrite, &byteswritten, &ov);
+            int iRet = WriteFile (port->portHandle, block1, (DWORD) size1, &byteswritten, &ov);
             if (threadShouldExit () || (GetLastError () != ERROR_SUCCESS && GetLastError () != ERROR_IO_PENDING))
                 continue;
             if (iRet == 0 && GetLastError() == ERROR_IO_PENDING)
@@ -416,37 +484,49 @@ void SerialPortOutputStream::run()
                     continue;
             }
             GetOverlappedResult (port->portHandle, &ov, &byteswritten, TRUE);
+            port->statistics.countWriteCall ((long) byteswritten);
             if (byteswritten)
-            {
-                const ScopedLock l (bufferCriticalSection);
-                buffer.removeSection (0, byteswritten);
-                bufferedbytes -= byteswritten;
-            }
+                removeFromBuffer (byteswritten);
         }
     }
     CloseHandle(ov.hEvent);
     //port->DebugLog ("SerialPortOutputStream::run", "starting");
+    stoppedServicing();
 }
 
 void SerialPortOutputStream::cancel ()
 {
+    triggerWrite.signal ();
     if (!port || port->portHandle == 0)
         return;
 
     port->cancel ();
 }
 
+void SerialPortOutputStream::triggerWriter ()
+{
+    triggerWrite.signal ();
+}
+
+bool SerialPortOutputStream::waitForTrigger ()
+{
+    triggerWrite.wait ();
+    return true;
+}
+
 bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
 {
+    return writeSome (dataToWrite, howManyBytes) == howManyBytes;
+}
+
+size_t SerialPortOutputStream::writeSome (const void* dataToWrite, size_t howManyBytes)
+{
+    if (port != nullptr && port->isVirtual())
+        return sendToVirtualPair (dataToWrite, howManyBytes);
     if (! port || port->portHandle == 0)
-        return false;
+        return 0;
 
-    bufferCriticalSection.enter();
-    buffer.append(dataToWrite, howManyBytes);
-    bufferedbytes += (int)howManyBytes;
-    bufferCriticalSection.exit();
-    triggerWrite.signal();
-    return true;
+    return addToBuffer (dataToWrite, howManyBytes);
 }
 
 #endif // JUCE_WIN
@@ -8,7 +8,11 @@ using namespace juce;
 
 StringPairArray SerialPort::getSerialPortPaths () { return StringPairArray(); }
 
-bool SerialPort::exists () { return false; }
+bool SerialPort::exists () { return isVirtual(); }
+
+int SerialPort::getNumBytesQueued () { return -1; }
+
+bool SerialPort::drain (int) { return false; }
 
 bool SerialPort::open (const String & portPath) { return false; }
 
@@ -20,18 +24,36 @@ bool SerialPort::setConfig(const SerialPortConfig &) { return false; }
 
 bool SerialPort::getConfig(SerialPortConfig &) { return false; }
 
+bool SerialPort::setBaudRate (juce::uint32) { return false; }
+
+bool SerialPort::openWithConfig (const String&, const SerialPortConfig&) { return false; }
+
 //========== SerialPortInputStream ==========
+int64 SerialPortInputStream::getTimestampNanos ()
+{
+    const auto ticks = Time::getHighResolutionTicks();
+    const auto ticksPerSecond = Time::getHighResolutionTicksPerSecond();
+    return (ticks / ticksPerSecond) * 1000000000 + (ticks % ticksPerSecond) * 1000000000 / ticksPerSecond;
+}
+
 void SerialPortInputStream::cancel () {}
 
-void SerialPortInputStream::run() {}
+void SerialPortInputStream::run() { stoppedServicing(); }
 
-int SerialPortInputStream::read(void*, int) { return -1; }
+//only the ends of a SerialPortVirtualPair can be used here
+int SerialPortInputStream::read(void* destBuffer, int maxBytesToRead) { return port->isVirtual() ? readFromBuffer (destBuffer, maxBytesToRead) : -1; }
 
 //========== SerialPortOutputStream ==========
 void SerialPortOutputStream::cancel () {}
 
-void SerialPortOutputStream::run() {}
+void SerialPortOutputStream::run() { stoppedServicing(); }
+
+void SerialPortOutputStream::triggerWriter () {}
+
+bool SerialPortOutputStream::waitForTrigger () { return false; }
+
+bool SerialPortOutputStream::write(const void* dataToWrite, size_t howManyBytes) { return writeSome (dataToWrite, howManyBytes) == howManyBytes; }
 
-bool SerialPortOutputStream::write(const void*, size_t) { return false; }
+size_t SerialPortOutputStream::writeSome (const void* dataToWrite, size_t howManyBytes) { return port->isVirtual() ? sendToVirtualPair (dataToWrite, howManyBytes) : 0; }
 
 #endif // JUCE_IOS
@@ -0,0 +1,22 @@
+//Main.cpp
+//runs the juce_serialport unit tests. Build it as a JUCE console application with juce_core and the juce_serialport
+//module, and the other files in this folder alongside this one. The tests play the far end of each port through a
+//pseudo terminal, so no hardware is needed, which means Linux only for now
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include <stdio.h>
+
+int main (int, char*[])
+{
+	UnitTestRunner runner;
+	runner.runTestsInCategory ("SerialPort");
+	int numFailures = 0;
+	for (int i = 0; i < runner.getNumResults(); ++i)
+		numFailures += runner.getResult (i)->failures;
+	printf ("%d failures\n", numFailures);
+	return numFailures == 0 ? 0 : 1;
+}
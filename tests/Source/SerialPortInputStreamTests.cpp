@@ -0,0 +1,357 @@
+//SerialPortInputStreamTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+#include "SerialPortTestPty.h"
+
+class SerialPortInputStreamTests : public UnitTest
+{
+public:
+	SerialPortInputStreamTests() : UnitTest ("SerialPortInputStream", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("the reader thread takes whole chunks from the driver");
+		checkBulkReads (nullptr);
+		beginTest ("the reactor takes whole chunks from the driver");
+		SerialPortReactor reactor;
+		checkBulkReads (&reactor);
+
+		beginTest ("the listener is given the time the chunk was read");
+		checkListenerTimes (nullptr);
+		checkListenerTimes (&reactor);
+
+		beginTest ("readWithTimestamps() gives each chunk's offset, past the ones that were dropped");
+		checkTimestamps (nullptr);
+		checkTimestamps (&reactor);
+
+		beginTest ("lines are found as they arrive and read without allocating");
+		checkLines (nullptr);
+		checkLines (&reactor);
+		beginTest ("a line that wraps around the end of the buffer");
+		checkWrappedLines (nullptr);
+		checkWrappedLines (&reactor);
+
+		for (auto policy : { SerialPortInputStream::OVERFLOW_BLOCK, SerialPortInputStream::OVERFLOW_DROP_NEWEST, SerialPortInputStream::OVERFLOW_DROP_OLDEST })
+		{
+			beginTest ("a full buffer is handled by overflow policy " + String ((int) policy));
+			checkOverflow (nullptr, policy);
+			checkOverflow (&reactor, policy);
+		}
+	}
+
+private:
+	static const size_t chunkSize = 4096;
+
+	void checkBulkReads (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		expect (pty.isOpen(), "couldn't make a pty");
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor) : new SerialPortInputStream (&port));
+		auto& input = *stream;
+
+		//the pty is kept full from this thread while the stream is read, so neither side can stall the other
+		const size_t total = 8 << 20;
+		HeapBlock<uint8> block (chunkSize), received (chunkSize);
+		size_t sent = 0, numReceived = 0;
+		bool intact = true;
+		const auto cpuBefore = SerialPortTestPty::getProcessCpuSeconds();
+		const auto before = port.getStatistics().getCounts();
+		const auto start = Time::getMillisecondCounterHiRes();
+		while (numReceived < total && Time::getMillisecondCounterHiRes() - start < 20000)
+		{
+			if (sent < total)
+			{
+				const auto numBytes = jmin (chunkSize, total - sent);
+				for (size_t i = 0; i < numBytes; ++i)
+					block[i] = (uint8) ((sent + i) % 251);
+				sent += pty.send (block, numBytes);
+			}
+			const auto numRead = input.readAtLeast (received, 1, (int) chunkSize, 100);
+			if (numRead < 0)
+				break;
+			for (int i = 0; i < numRead; ++i)
+				intact = intact && received[i] == (uint8) ((numReceived + (size_t) i) % 251);
+			numReceived += (size_t) numRead;
+		}
+		const auto seconds = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+		const auto cpuSeconds = SerialPortTestPty::getProcessCpuSeconds() - cpuBefore;
+		const auto after = port.getStatistics().getCounts();
+		expectEquals (numReceived, total, "not everything sent came back out of the stream");
+		expect (intact, "the data came out of the stream changed or out of order");
+		expectEquals (after.bytesIn - before.bytesIn, (uint64) total);
+
+		//a read per byte would be a million a megabyte. The pty hands over up to 4k at a time
+		const auto megabytes = (double) total / (1024.0 * 1024.0);
+		const auto readsPerMegabyte = (double) (after.readCalls - before.readCalls) / megabytes;
+		expectLessThan (readsPerMegabyte, 4096.0, "the reader isn't taking whole chunks");
+		logMessage (String (readsPerMegabyte, 1) + " read() calls/MB, " + String (cpuSeconds * 1000.0 / megabytes, 2) + " cpu ms/MB, "
+					+ String (megabytes / seconds, 1) + " MB/s");
+	}
+
+	void checkListenerTimes (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor) : new SerialPortInputStream (&port));
+		struct TimeListener : public SerialPortInputStream::Listener
+		{
+			void serialDataReceived (SerialPortInputStream&, const uint8_t*, size_t, int64 receivedNanos) override
+			{
+				if (calledNanos == 0)
+				{
+					calledNanos = SerialPortInputStream::getTimestampNanos();
+					readNanos = receivedNanos;
+				}
+				arrived.signal();
+			}
+			std::atomic<int64> readNanos { 0 }, calledNanos { 0 };
+			WaitableEvent arrived;
+		} listener;
+		stream->setListener (&listener);
+		const auto sentNanos = SerialPortInputStream::getTimestampNanos();
+		expectEquals ((int) pty.send ("x", 1), 1);
+		expect (listener.arrived.wait (1000), "the listener wasn't called");
+		stream->setListener (nullptr);
+		expect (sentNanos <= listener.readNanos && listener.readNanos <= listener.calledNanos,
+				"the time given isn't from getTimestampNanos(), between the send and the callback");
+	}
+
+	//three chunks of 40 bytes into a 64 byte buffer that drops the oldest, so the first chunk goes altogether and the
+	//second loses 16 bytes
+	void checkTimestamps (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor, 64)
+																		  : new SerialPortInputStream (&port, 64));
+		auto& input = *stream;
+		input.setOverflowPolicy (SerialPortInputStream::OVERFLOW_DROP_OLDEST);
+		const auto before = SerialPortInputStream::getTimestampNanos();
+		for (auto c : { 'A', 'B', 'C' })
+		{
+			const String chunk (std::string (40, c));
+			const auto numArrived = input.getTotalLength() + (int64) input.getNumBytesDropped();
+			expectEquals (pty.send (chunk.toRawUTF8(), 40), (size_t) 40);
+			for (int i = 0; i < 1000 && input.getTotalLength() + (int64) input.getNumBytesDropped() < numArrived + 40; ++i)
+				Thread::sleep (1);
+			//a gap, so each goes in as a chunk of its own
+			Thread::sleep (20);
+		}
+		expectEquals (input.getNumBytesDropped(), (uint64) 56);
+
+		char data[64];
+		SerialPortInputStream::ReceiveTime times[4];
+		int numTimes = 0;
+		//with room for only one time, the read stops where the next chunk starts
+		expectEquals (input.readWithTimestamps (data, 64, times, 1, numTimes), 24);
+		expectEquals (numTimes, 1);
+		expectEquals (times[0].offset, (size_t) 0);
+		expect (String (data, 24) == String (std::string (24, 'B')), "the dropped bytes weren't the oldest");
+		const auto bTime = times[0].timestampNanos;
+		expectEquals (input.readWithTimestamps (data, 64, times, 4, numTimes), 40);
+		expectEquals (numTimes, 1);
+		expect (String (data, 40) == String (std::string (40, 'C')));
+		expect (before < bTime && bTime + 10000000 < times[0].timestampNanos, "the chunks don't have their own times");
+
+		//the same again in one read, where the dropped chunk's time is replaced by the one after it
+		for (auto c : { 'A', 'B', 'C' })
+		{
+			const String chunk (std::string (40, c));
+			pty.send (chunk.toRawUTF8(), 40);
+			Thread::sleep (20);
+		}
+		expectEquals (input.readWithTimestamps (data, 64, times, 4, numTimes), 64);
+		expectEquals (numTimes, 2, "the chunk that was dropped altogether still has a time");
+		expectEquals (times[0].offset, (size_t) 0);
+		expectEquals (times[1].offset, (size_t) 24);
+		expect (times[0].timestampNanos < times[1].timestampNanos);
+	}
+
+	//sends text through the pty, and waits for the stream to have it all
+	bool arrive (SerialPortTestPty& pty, SerialPortInputStream& input, const char* text, size_t numBytes)
+	{
+		const auto numReady = input.getTotalLength() + (int64) numBytes;
+		expectEquals (pty.send (text, numBytes), numBytes);
+		for (int i = 0; i < 1000 && input.getTotalLength() < numReady; ++i)
+			Thread::sleep (1);
+		expectEquals (input.getTotalLength(), numReady, "what was sent didn't all arrive");
+		return input.getTotalLength() == numReady;
+	}
+	bool arrive (SerialPortTestPty& pty, SerialPortInputStream& input, const char* text) { return arrive (pty, input, text, strlen (text)); }
+
+	//a 64 byte buffer, so lines can be made to wrap around its end
+	void checkLines (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		const size_t bufferSize = 64;
+		std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor, bufferSize)
+																		  : new SerialPortInputStream (&port, bufferSize));
+		auto& input = *stream;
+		char line[64];
+		size_t lineLength = 0;
+		std::string_view view;
+
+		//the index only moves on when a delimiter arrives, however the data is split up
+		arrive (pty, input, "abc");
+		expect (! input.canReadLine(), "a line was found with no delimiter");
+		expect (! input.readLine (line, sizeof (line), lineLength));
+		arrive (pty, input, "def\nxy");
+		expect (input.canReadLine(), "the delimiter wasn't indexed");
+		expect (input.readLine (line, sizeof (line), lineLength));
+		expectEquals (String (line, lineLength), String ("abcdef"));
+		expect (! input.canReadLine(), "the index wasn't passed by reading the line");
+		arrive (pty, input, "z\n");
+		expect (input.readLine (view));
+		expectEquals (String (view.data(), view.size()), String ("xyz"));
+		expectEquals (input.getTotalLength(), (int64) 0);
+
+		//a line exactly as long as dest fits, and takes its delimiter with it. A longer one comes out in pieces
+		arrive (pty, input, "hello\nhelloworld\n");
+		expect (input.readLine (line, 5, lineLength));
+		expectEquals (String (line, lineLength), String ("hello"));
+		expect (input.readLine (line, 5, lineLength));
+		expectEquals (String (line, lineLength), String ("hello"));
+		expect (input.readLine (line, 5, lineLength));
+		expectEquals (String (line, lineLength), String ("world"));
+		expectEquals (input.getTotalLength(), (int64) 0, "the delimiter after a line of exactly destSize was left behind");
+
+		input.setLineEnding (SerialPortInputStream::LINE_CRLF);
+		arrive (pty, input, "one\r\ntwo\na\rb\r\n");
+		for (auto* expected : { "one", "two", "a\rb" })
+		{
+			expect (input.readLine (view));
+			expectEquals (String (view.data(), view.size()), String (expected));
+		}
+
+		//with no delimiter a line is cut at the maximum, and one of exactly the maximum keeps its delimiter
+		input.setMaxLineLength (8);
+		arrive (pty, input, "0123456");
+		expect (! input.canReadLine());
+		arrive (pty, input, "789abcdefXY\r\n01234567\r\n");
+		for (auto* expected : { "01234567", "89abcdef", "XY", "01234567" })
+		{
+			expect (input.canReadLine());
+			expect (input.readLine (view));
+			expectEquals (String (view.data(), view.size()), String (expected));
+		}
+		expectEquals (input.getTotalLength(), (int64) 0, "the delimiter after a line of exactly the maximum was left behind");
+		input.setMaxLineLength (0);
+		input.setLineEnding (SerialPortInputStream::LINE_LF);
+
+		//NUL terminated strings are indexed the same way
+		arrive (pty, input, "first\0sec", 9);
+		expect (input.canReadString());
+		expectEquals (input.readString(), String ("first"));
+		expect (! input.canReadString());
+		arrive (pty, input, "ond", 4);
+		expectEquals (input.readString(), String ("second"));
+	}
+
+	//a line that wraps around the end of a 64 byte buffer, read each of the three ways
+	void checkWrappedLines (SerialPortReactor* reactor)
+	{
+		const String padding ("the first line, which takes this many bytes\n");
+		const String wrapped ("wrapped around the end of the buffer");
+		for (int way = 0; way < 3; ++way)
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, nullptr);
+			if (! port.exists())
+				return;
+			std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor, 64)
+																			  : new SerialPortInputStream (&port, 64));
+			auto& input = *stream;
+			std::string_view view;
+			char line[64];
+			size_t lineLength = 0;
+			arrive (pty, input, padding.toRawUTF8());
+			expect (input.readLine (view));
+			arrive (pty, input, (wrapped + "\n").toRawUTF8());
+			String got;
+			if (way == 0 && input.readLine (line, sizeof (line), lineLength))
+				got = String (line, lineLength);
+			else if (way == 1 && input.readLine (view))
+				got = String (view.data(), view.size());
+			else if (way == 2)
+				got = input.readNextLine();
+			expectEquals (got, wrapped, "a line that wraps around the buffer came out wrong");
+			expectEquals (input.getTotalLength(), (int64) 0);
+		}
+	}
+
+	//far more is sent than the buffer holds, and read slower than it arrives. Every byte is either read or counted as
+	//dropped, and blocking holds the pty off rather than dropping anything
+	void checkOverflow (SerialPortReactor* reactor, SerialPortInputStream::overflowpolicy policy)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		const size_t bufferSize = 256;
+		std::unique_ptr<SerialPortInputStream> stream (reactor != nullptr ? new SerialPortInputStream (&port, *reactor, bufferSize)
+																		  : new SerialPortInputStream (&port, bufferSize));
+		auto& input = *stream;
+		input.setOverflowPolicy (policy);
+
+		const size_t total = 200 * 1024;
+		HeapBlock<uint8> block (chunkSize), received (64);
+		size_t sent = 0, numReceived = 0;
+		bool intact = true;
+		const auto start = Time::getMillisecondCounterHiRes();
+		while (Time::getMillisecondCounterHiRes() - start < 20000)
+		{
+			if (sent < total)
+			{
+				const auto numBytes = jmin (chunkSize, total - sent);
+				for (size_t i = 0; i < numBytes; ++i)
+					block[i] = (uint8) ((sent + i) % 251);
+				sent += pty.send (block, numBytes);
+			}
+			//once everything has been sent, a quiet spell means it has all been dealt with
+			const auto numRead = input.readAtLeast (received, 1, 64, sent < total ? 1 : 200);
+			if (numRead <= 0 && sent == total)
+				break;
+			for (int i = 0; i < numRead; ++i)
+				intact = intact && received[i] == (uint8) ((numReceived + (size_t) i) % 251);
+			numReceived += (size_t) jmax (0, numRead);
+		}
+		expectEquals (sent, total, "the pty wouldn't take everything");
+		expectEquals (numReceived + (size_t) input.getNumBytesDropped(), total, "bytes went missing without being counted as dropped");
+		expectGreaterThan (input.getNumOverflows(), (uint64) 0, "the buffer never filled up");
+		if (policy == SerialPortInputStream::OVERFLOW_BLOCK)
+		{
+			expectEquals (input.getNumBytesDropped(), (uint64) 0, "blocking dropped data");
+			expect (intact, "the data came out of the stream changed or out of order");
+		}
+		else
+		{
+			expectGreaterThan (input.getNumBytesDropped(), (uint64) 0, "nothing was dropped");
+		}
+	}
+};
+
+static SerialPortInputStreamTests serialPortInputStreamTests;
+
+#endif // JUCE_LINUX
@@ -0,0 +1,145 @@
+//SerialPortMonitorTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+#include "SerialPortTestPty.h"
+
+class SerialPortMonitorTests : public UnitTest
+{
+public:
+	SerialPortMonitorTests() : UnitTest ("SerialPortMonitor", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("ptys are reported as they come and go");
+		{
+			Events events;
+			SerialPortMonitor monitor (events, true);
+			logMessage (monitor.isUsingNetlink() ? "listening for uevents" : "no uevent socket, watching /dev");
+			auto start = Time::getMillisecondCounterHiRes();
+			std::unique_ptr<SerialPortTestPty> pty (new SerialPortTestPty());
+			const auto path = pty->path;
+			expect (events.waitFor (path, true, 1000), "the new pty wasn't reported");
+			logMessage ("added after " + String (Time::getMillisecondCounterHiRes() - start, 2) + "ms");
+			start = Time::getMillisecondCounterHiRes();
+			pty.reset();
+			expect (events.waitFor (path, false, 1000), "the pty going wasn't reported");
+			logMessage ("removed after " + String (Time::getMillisecondCounterHiRes() - start, 2) + "ms");
+		}
+
+		beginTest ("uevents fed in by hand are reported the same as the kernel's");
+		{
+			Events events;
+			SerialPortMonitor monitor (events, true);
+			const char add[] = "add@/devices/virtual/tty/pts/4000\0ACTION=add\0DEVPATH=/devices/virtual/tty/pts/4000\0SUBSYSTEM=tty\0DEVNAME=pts/4000";
+			const char remove[] = "remove@/devices/virtual/tty/pts/4000\0ACTION=remove\0DEVPATH=/devices/virtual/tty/pts/4000\0SUBSYSTEM=tty\0DEVNAME=pts/4000";
+			const char other[] = "add@/devices/virtual/block/loop9\0ACTION=add\0SUBSYSTEM=block\0DEVNAME=loop9";
+			monitor.handleUevent (add, sizeof (add));
+			monitor.handleUevent (add, sizeof (add));
+			monitor.handleUevent (other, sizeof (other));
+			expectEquals (events.count ("/dev/pts/4000", true), 1, "a port was reported added more than once, or not at all");
+			expectEquals (events.count ("/dev/loop9", true), 0, "something that isn't a tty was reported");
+			monitor.handleUevent (remove, sizeof (remove));
+			monitor.handleUevent (remove, sizeof (remove));
+			expectEquals (events.count ("/dev/pts/4000", false), 1, "a port was reported removed more than once, or not at all");
+		}
+
+		beginTest ("the enumerator only makes its list again when /dev changes");
+		{
+			SerialPortEnumerator enumerator;
+			const auto ports = enumerator.getPorts();
+			const auto numScans = enumerator.getNumScans();
+			expectGreaterThan (numScans, (uint64) 0);
+			SerialPortInfo info;
+			for (int i = 0; i < 10; ++i)
+			{
+				expectEquals (enumerator.getPorts().size(), ports.size());
+				enumerator.findByPath ("/dev/ttySerialPortTestMissing", info);
+				enumerator.findBySerialNumber ("no such serial number", info);
+				enumerator.findByVendorAndProduct (0xffff, 0xffff);
+			}
+			expectEquals (enumerator.getNumScans(), numScans, "the list was made again with nothing changed");
+
+			//a file in /dev that isn't a tty doesn't matter, one that is might
+			const File other ("/dev/serialport-test-" + String (getpid()));
+			const File tty ("/dev/ttySerialPortTest" + String (getpid()));
+			if (other.create().failed() || tty.create().failed())
+				logMessage ("can't make files in /dev, so not checking it is watched");
+			else
+			{
+				enumerator.getPorts();
+				expectEquals (enumerator.getNumScans(), numScans + 1, "a tty appearing in /dev didn't make the list again");
+				enumerator.getPorts();
+				expectEquals (enumerator.getNumScans(), numScans + 1, "the list was made again without anything more changing");
+				tty.deleteFile();
+				enumerator.findByPath (tty.getFullPathName(), info);
+				expectEquals (enumerator.getNumScans(), numScans + 2, "a tty going from /dev didn't make the list again");
+			}
+			other.deleteFile();
+			tty.deleteFile();
+			enumerator.getPorts();
+			const auto afterChanges = enumerator.getNumScans();
+			enumerator.invalidate();
+			enumerator.getPorts();
+			expectEquals (enumerator.getNumScans(), afterChanges + 1, "invalidate() didn't make the list again");
+		}
+	}
+
+private:
+	//what the monitor has reported so far, called on its thread
+	class Events : public SerialPortMonitor::Listener
+	{
+	public:
+		void serialPortAdded (const SerialPortInfo& port) override { note (port, true); }
+		void serialPortRemoved (const SerialPortInfo& port) override { note (port, false); }
+
+		int count (const String& path, bool added) const
+		{
+			const ScopedLock sl (lock);
+			int n = 0;
+			for (auto& event : events)
+				n += event.path == path && event.added == added ? 1 : 0;
+			return n;
+		}
+		bool waitFor (const String& path, bool added, int timeoutMs)
+		{
+			const auto deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+			while (count (path, added) == 0)
+			{
+				const auto remaining = (int) std::ceil (deadline - Time::getMillisecondCounterHiRes());
+				if (remaining <= 0)
+					return false;
+				changed.wait (remaining);
+			}
+			return true;
+		}
+
+	private:
+		struct Event
+		{
+			String path;
+			bool added;
+		};
+		void note (const SerialPortInfo& port, bool added)
+		{
+			{
+				const ScopedLock sl (lock);
+				events.add ({ port.path, added });
+			}
+			changed.signal();
+		}
+		CriticalSection lock;
+		Array<Event> events;
+		WaitableEvent changed;
+	};
+};
+
+static SerialPortMonitorTests serialPortMonitorTests;
+
+#endif // JUCE_LINUX
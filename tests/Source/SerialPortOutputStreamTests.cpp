@@ -0,0 +1,303 @@
+//SerialPortOutputStreamTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+#include "SerialPortTestPty.h"
+
+class SerialPortOutputStreamTests : public UnitTest
+{
+public:
+	SerialPortOutputStreamTests() : UnitTest ("SerialPortOutputStream", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("the writer thread sends straight from the queue");
+		checkThroughput (nullptr);
+		beginTest ("the reactor sends straight from the queue");
+		SerialPortReactor reactor;
+		checkThroughput (&reactor);
+		beginTest ("an idle writer thread is never woken");
+		checkWakeups (nullptr);
+		beginTest ("an idle port never wakes the reactor");
+		checkWakeups (&reactor);
+		beginTest ("a write that times out queues all of itself or nothing");
+		checkPartialWrites (nullptr);
+		beginTest ("a write that times out on the reactor queues all of itself or nothing");
+		checkPartialWrites (&reactor);
+		beginTest ("drain() waits for the queue to empty, and gives up when the port does");
+		checkDrain (nullptr);
+		checkDrain (&reactor);
+		beginTest ("the listener is told when the queue crosses its watermarks");
+		checkWatermarks (nullptr);
+		checkWatermarks (&reactor);
+	}
+
+private:
+	static const size_t chunkSize = 1 << 16;
+
+	void checkThroughput (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		expect (pty.isOpen(), "couldn't make a pty");
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortOutputStream> stream (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor) : new SerialPortOutputStream (&port));
+		auto& output = *stream;
+		//this thread also empties the pty, so write() mustn't wait for room
+		output.setOverflowPolicy (SerialPortOutputStream::OVERFLOW_FAIL);
+
+		const size_t total = 8 << 20;
+		HeapBlock<uint8> block (chunkSize), received (chunkSize);
+		size_t sent = 0, numReceived = 0;
+		bool intact = true;
+		const auto cpuBefore = SerialPortTestPty::getProcessCpuSeconds();
+		const auto before = port.getStatistics().getCounts();
+		const auto start = Time::getMillisecondCounterHiRes();
+		while (numReceived < total && Time::getMillisecondCounterHiRes() - start < 20000)
+		{
+			if (sent < total)
+			{
+				const auto numBytes = jmin (chunkSize, total - sent);
+				for (size_t i = 0; i < numBytes; ++i)
+					block[i] = (uint8) ((sent + i) % 251);
+				if (output.write (block, numBytes))
+					sent += numBytes;
+			}
+			const auto numRead = pty.receive (received, chunkSize, 1);
+			for (size_t i = 0; i < numRead; ++i)
+				intact = intact && received[i] == (uint8) ((numReceived + i) % 251);
+			numReceived += numRead;
+		}
+		const auto seconds = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+		const auto cpuSeconds = SerialPortTestPty::getProcessCpuSeconds() - cpuBefore;
+		const auto after = port.getStatistics().getCounts();
+		expectEquals (numReceived, total, "not everything written came out of the pty");
+		expect (intact, "the data came out of the pty changed or out of order");
+		expectEquals (after.bytesOut - before.bytesOut, (uint64) total);
+
+		//the old writer copied out 128 bytes at a time, which was 8192 write() calls a megabyte
+		const auto megabytes = (double) total / (1024.0 * 1024.0);
+		const auto writesPerMegabyte = (double) (after.writeCalls - before.writeCalls) / megabytes;
+		expectLessThan (writesPerMegabyte, 1024.0, "the writer isn't sending whole spans of the queue");
+		logMessage (String (writesPerMegabyte, 1) + " writev() calls/MB, " + String (cpuSeconds * 1000.0 / megabytes, 2) + " cpu ms/MB, "
+					+ String (megabytes / seconds, 1) + " MB/s");
+	}
+
+	//nothing written means nothing to wake up for, and what is written goes out as soon as the writer is scheduled
+	//rather than on a timer
+	void checkWakeups (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortOutputStream> stream (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor) : new SerialPortOutputStream (&port));
+		auto& output = *stream;
+
+		Thread::sleep (500);
+		expectEquals (output.getNumWriterWakeups(), (uint64) 0, "the writer woke up with nothing to send");
+
+		const int numWrites = 200;
+		uint8 byte = 0;
+		int numArrived = 0;
+		for (int i = 0; i < numWrites; ++i)
+		{
+			output.write (&byte, 1);
+			numArrived += (int) pty.receive (&byte, 1, 1000);
+		}
+		expectEquals (numArrived, numWrites, "not every byte written came out of the pty");
+		std::unique_ptr<SerialPortLatencyHistogram::Snapshot> latency (new SerialPortLatencyHistogram::Snapshot());
+		port.getStatistics().getWriteLatency (*latency);
+		//the old writer looked at its queue every 100ms
+		expectLessThan (latency->getValueAtPercentile (99.0), (int64) 20000000, "written data waited for the writer");
+
+		//the last byte can reach the far end before the call that sent it has been counted
+		Thread::sleep (50);
+		const auto wakeups = output.getNumWriterWakeups();
+		const auto counts = port.getStatistics().getCounts();
+		Thread::sleep (500);
+		expectEquals (output.getNumWriterWakeups(), wakeups, "the writer woke up again after the port went idle");
+		expectEquals (port.getStatistics().getCounts().writeCalls, counts.writeCalls);
+		logMessage (String (wakeups) + " wakeups for " + String (numWrites) + " writes, write to driver p50 "
+					+ String (latency->getValueAtPercentile (50.0) / 1000.0, 1) + "us p99 " + String (latency->getValueAtPercentile (99.0) / 1000.0, 1) + "us");
+	}
+
+	//with nothing reading the pty the writes run out of time once it and the queue are full. What comes out at the far
+	//end has to be exactly what writeSome() said it had queued
+	void checkPartialWrites (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		const size_t queueSize = 256;
+		std::unique_ptr<SerialPortOutputStream> stream (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor, queueSize)
+																			 : new SerialPortOutputStream (&port, queueSize));
+		auto& output = *stream;
+		output.setOverflowPolicy (SerialPortOutputStream::OVERFLOW_BLOCK, 20);
+
+		HeapBlock<uint8> block (queueSize * 4);
+		size_t numQueued = 0;
+		auto fill = [&] (size_t numBytes)
+		{
+			for (size_t i = 0; i < numBytes; ++i)
+				block[i] = (uint8) ((numQueued + i) % 251);
+		};
+		//small writes until one of them doesn't fit
+		bool full = false;
+		for (int i = 0; i < 100000 && ! full; ++i)
+		{
+			fill (200);
+			const auto n = output.writeSome (block, 200);
+			numQueued += n;
+			if (n < 200)
+			{
+				expectEquals (n, (size_t) 0, "a write that fits in the queue was left half queued");
+				full = true;
+			}
+		}
+		expect (full, "the pty never filled up");
+		fill (200);
+		expect (! output.write (block, 200), "write() said it had queued data there was no room for");
+
+		//one bigger than the queue goes in pieces, and says how much of it made it
+		fill (queueSize * 4);
+		const auto n = output.writeSome (block, queueSize * 4);
+		expectLessThan (n, queueSize * 4);
+		numQueued += n;
+
+		HeapBlock<uint8> received (4096);
+		size_t numReceived = 0;
+		bool intact = true;
+		while (auto numRead = pty.receive (received, 4096, 500))
+		{
+			for (size_t i = 0; i < numRead; ++i)
+				intact = intact && received[i] == (uint8) ((numReceived + i) % 251);
+			numReceived += numRead;
+		}
+		expectEquals (numReceived, numQueued, "what came out of the pty isn't what writeSome() said it queued");
+		expect (intact, "the data came out of the pty changed or out of order");
+	}
+
+	//empties the far end of the pty on a thread of its own
+	struct Receiver : public Thread
+	{
+		Receiver (SerialPortTestPty& p) : Thread ("SerialTestReceiver"), pty (p) {}
+		void run() override
+		{
+			HeapBlock<uint8> block (chunkSize);
+			while (! threadShouldExit())
+				numReceived += pty.receive (block, chunkSize, 10);
+		}
+		SerialPortTestPty& pty;
+		std::atomic<size_t> numReceived { 0 };
+	};
+
+	//writes until the pty and then the queue are full, with nothing reading the far end, and returns how much that was
+	static size_t fillUp (SerialPortOutputStream& output, size_t numBytesEach)
+	{
+		output.setOverflowPolicy (SerialPortOutputStream::OVERFLOW_FAIL);
+		HeapBlock<uint8> block (numBytesEach, true);
+		size_t total = 0;
+		while (output.write (block, numBytesEach))
+			total += numBytesEach;
+		return total;
+	}
+
+	void checkDrain (SerialPortReactor* reactor)
+	{
+		std::unique_ptr<SerialPortTestPty> pty (new SerialPortTestPty());
+		SerialPort port (pty->path, nullptr);
+		expect (port.exists(), "couldn't open " + pty->path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortOutputStream> stream (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor, 1 << 16)
+																			 : new SerialPortOutputStream (&port, 1 << 16));
+		auto& output = *stream;
+		const auto total = fillUp (output, 1024);
+		expectGreaterThan (output.getNumBytesQueued(), (size_t) 0);
+
+		auto start = Time::getMillisecondCounterHiRes();
+		expect (! output.drain (50), "drain() returned with the data still queued");
+		const auto timedOut = Time::getMillisecondCounterHiRes() - start;
+		expectGreaterOrEqual (timedOut, 49.0, "drain() gave up early");
+		expectLessThan (timedOut, 500.0, "drain() overran its timeout");
+
+		{
+			Receiver receiver (*pty);
+			receiver.startThread();
+			expect (output.drain (5000), "drain() didn't see the queue empty");
+			expectEquals (output.getNumBytesQueued(), (size_t) 0);
+			for (int i = 0; i < 2000 && receiver.numReceived < total; ++i)
+				Thread::sleep (1);
+			expectEquals ((size_t) receiver.numReceived, total, "not everything drained came out of the pty");
+			receiver.stopThread (1000);
+		}
+
+		//with the far end gone, the port stops and drain() hears about it straight away
+		fillUp (output, 1024);
+		pty = nullptr;
+		start = Time::getMillisecondCounterHiRes();
+		expect (! output.drain(), "drain() said a port that hung up had sent everything");
+		expectLessThan (Time::getMillisecondCounterHiRes() - start, 100.0, "drain() took too long to see the port stop");
+	}
+
+	void checkWatermarks (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortOutputStream> stream (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor, 4096)
+																			 : new SerialPortOutputStream (&port, 4096));
+		auto& output = *stream;
+		struct WatermarkListener : public SerialPortOutputStream::Listener
+		{
+			void queueAboveHighWatermark (SerialPortOutputStream&, size_t numBytesQueued) override
+			{
+				++numAbove;
+				queuedWhenAbove = numBytesQueued;
+			}
+			void queueBelowLowWatermark (SerialPortOutputStream&, size_t numBytesQueued) override
+			{
+				++numBelow;
+				queuedWhenBelow = numBytesQueued;
+				below.signal();
+			}
+			std::atomic<int> numAbove { 0 }, numBelow { 0 };
+			std::atomic<size_t> queuedWhenAbove { 0 }, queuedWhenBelow { 0 };
+			WaitableEvent below;
+		} listener;
+		output.setListener (&listener, 3000, 1000);
+
+		fillUp (output, 500);
+		expectEquals ((int) listener.numAbove, 1, "the high watermark wasn't reported once");
+		expectGreaterOrEqual ((size_t) listener.queuedWhenAbove, (size_t) 3000);
+		expectEquals ((int) listener.numBelow, 0, "the low watermark was reported before the queue emptied");
+
+		Receiver receiver (pty);
+		receiver.startThread();
+		expect (listener.below.wait (2000), "the low watermark wasn't reported");
+		expect (output.drain (2000));
+		receiver.stopThread (1000);
+		output.setListener (nullptr, 0, 0);
+		expectEquals ((int) listener.numBelow, 1, "the low watermark wasn't reported once");
+		expectLessOrEqual ((size_t) listener.queuedWhenBelow, (size_t) 1000);
+		expectEquals ((int) listener.numAbove, 1, "the high watermark was reported again as the queue emptied");
+	}
+};
+
+static SerialPortOutputStreamTests serialPortOutputStreamTests;
+
+#endif // JUCE_LINUX
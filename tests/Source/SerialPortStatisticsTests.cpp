@@ -0,0 +1,149 @@
+//SerialPortStatisticsTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+#include "SerialPortTestPty.h"
+
+class SerialPortStatisticsTests : public UnitTest
+{
+public:
+	SerialPortStatisticsTests() : UnitTest ("SerialPortStatistics", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("the histogram's buckets are within 6% of what they hold");
+		checkBuckets();
+		beginTest ("the histogram gives back the mean, maximum and percentiles of what it was given");
+		checkHistogram();
+		beginTest ("the streams count what they do");
+		checkCounts (nullptr);
+		SerialPortReactor reactor;
+		checkCounts (&reactor);
+		beginTest ("the drops are counted");
+		checkDropCounts();
+	}
+
+private:
+	void checkBuckets()
+	{
+		bool allWithin = true, allInOrder = true;
+		int lastBucket = 0;
+		for (uint64 value = 0; value < ((uint64) 1 << 40); value = value * 9 / 8 + 1)
+		{
+			const auto bucket = SerialPortLatencyHistogram::getBucket (value);
+			const auto start = SerialPortLatencyHistogram::getBucketStart (bucket);
+			allWithin = allWithin && start <= value && (double) (value - start) <= (double) start * 0.0625;
+			allInOrder = allInOrder && bucket >= lastBucket && bucket < SerialPortLatencyHistogram::numBuckets;
+			lastBucket = bucket;
+		}
+		expect (allWithin, "a value was counted in a bucket that doesn't start within 6% of it");
+		expect (allInOrder, "bigger values went in smaller buckets");
+		expectEquals (SerialPortLatencyHistogram::getBucket (((uint64) 1 << 40) - 1), SerialPortLatencyHistogram::numBuckets - 1);
+	}
+
+	void checkHistogram()
+	{
+		std::unique_ptr<SerialPortLatencyHistogram> histogram (new SerialPortLatencyHistogram());
+		for (int i = 0; i < 990; ++i)
+			histogram->record (1000000);
+		for (int i = 0; i < 10; ++i)
+			histogram->record (100000000);
+		//out of range values are kept in range rather than lost
+		histogram->record (-5);
+		histogram->record ((int64) 1 << 50);
+
+		std::unique_ptr<SerialPortLatencyHistogram::Snapshot> snapshot (new SerialPortLatencyHistogram::Snapshot());
+		histogram->getSnapshot (*snapshot);
+		expectEquals (snapshot->total, (uint64) 1002);
+		expectEquals (snapshot->maximum, ((uint64) 1 << 40) - 1);
+		expectEquals (snapshot->counts[0], (uint64) 1, "a negative value wasn't counted as 0");
+		expectEquals (snapshot->sum, (uint64) 990 * 1000000 + (uint64) 10 * 100000000 + ((uint64) 1 << 40) - 1);
+		const auto near = [] (int64 value, int64 expected) { return value <= expected && (double) (expected - value) <= (double) expected * 0.0625; };
+		expect (near (snapshot->getValueAtPercentile (50.0), 1000000), "the median is wrong");
+		expect (near (snapshot->getValueAtPercentile (99.5), 100000000), "the 99.5th percentile is wrong");
+		expectEquals (snapshot->getValueAtPercentile (0.0), (int64) 0);
+		expectEquals (snapshot->getMean(), (double) snapshot->sum / 1002.0);
+	}
+
+	//three chunks with gaps between them, left unread for a while, and a write back the other way
+	void checkCounts (SerialPortReactor* reactor)
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		expect (port.exists(), "couldn't open " + pty.path);
+		if (! port.exists())
+			return;
+		std::unique_ptr<SerialPortInputStream> input (reactor != nullptr ? new SerialPortInputStream (&port, *reactor) : new SerialPortInputStream (&port));
+		std::unique_ptr<SerialPortOutputStream> output (reactor != nullptr ? new SerialPortOutputStream (&port, *reactor) : new SerialPortOutputStream (&port));
+		const auto before = port.getStatistics().getCounts();
+
+		const char chunk[100] = {};
+		for (int i = 0; i < 3; ++i)
+		{
+			expectEquals (pty.send (chunk, sizeof (chunk)), sizeof (chunk));
+			for (int j = 0; j < 1000 && input->getTotalLength() < (int64) (sizeof (chunk) * (size_t) (i + 1)); ++j)
+				Thread::sleep (1);
+			Thread::sleep (10);
+		}
+		Thread::sleep (50);
+		char received[300];
+		expectEquals (input->readExactly (received, 300, 1000), 300);
+
+		const int numToWrite = 1000;
+		HeapBlock<uint8> block (numToWrite, true);
+		expect (output->write (block, numToWrite));
+		expect (output->drain (1000));
+		expectEquals (pty.receive (block, numToWrite, 1000), (size_t) numToWrite);
+
+		const auto after = port.getStatistics().getCounts();
+		expectEquals (after.bytesIn - before.bytesIn, (uint64) 300);
+		expectEquals (after.chunksIn - before.chunksIn, (uint64) 3, "the chunks weren't counted as they came");
+		expectGreaterOrEqual (after.readCalls - before.readCalls, (uint64) 3);
+		expectEquals (after.inputQueueHighWater, (size_t) 300);
+		expectEquals (after.bytesDroppedIn, (uint64) 0);
+		expectEquals (after.bytesOut - before.bytesOut, (uint64) numToWrite);
+		expectGreaterOrEqual (after.writeCalls - before.writeCalls, after.chunksOut - before.chunksOut);
+		expectGreaterThan (after.chunksOut - before.chunksOut, (uint64) 0);
+		expectGreaterThan (after.outputQueueHighWater, (size_t) 0);
+		expectLessOrEqual (after.outputQueueHighWater, (size_t) numToWrite);
+
+		std::unique_ptr<SerialPortLatencyHistogram::Snapshot> latency (new SerialPortLatencyHistogram::Snapshot());
+		port.getStatistics().getReadLatency (*latency);
+		expectEquals (latency->total, (uint64) 3, "there isn't a read latency for each chunk");
+		//the last chunk waited at least the 60ms before the read, and the first longer
+		expectGreaterOrEqual ((int64) latency->maximum, (int64) 60000000);
+		expectGreaterOrEqual (latency->getValueAtPercentile (1.0), (int64) 50000000, "the read latency is shorter than the wait");
+		port.getStatistics().getWriteLatency (*latency);
+		expectGreaterThan (latency->total, (uint64) 0, "the write latency wasn't recorded");
+		expectLessThan (latency->getValueAtPercentile (50.0), (int64) 100000000);
+	}
+
+	void checkDropCounts()
+	{
+		SerialPortTestPty pty;
+		SerialPort port (pty.path, nullptr);
+		if (! port.exists())
+			return;
+		SerialPortInputStream input (&port, 64);
+		input.setOverflowPolicy (SerialPortInputStream::OVERFLOW_DROP_NEWEST);
+		const char chunk[100] = {};
+		expectEquals (pty.send (chunk, sizeof (chunk)), sizeof (chunk));
+		for (int i = 0; i < 1000 && input.getNumBytesDropped() < 36; ++i)
+			Thread::sleep (1);
+		const auto counts = port.getStatistics().getCounts();
+		expectEquals (counts.bytesIn, (uint64) 100);
+		expectEquals (counts.bytesDroppedIn, (uint64) 36);
+		expectEquals (counts.bytesDroppedIn, input.getNumBytesDropped());
+		expectEquals (counts.inputQueueHighWater, (size_t) 64);
+	}
+};
+
+static SerialPortStatisticsTests serialPortStatisticsTests;
+
+#endif // JUCE_LINUX
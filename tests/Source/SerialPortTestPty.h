@@ -0,0 +1,70 @@
+//SerialPortTestPty.h
+//a pseudo terminal for the tests to open a SerialPort on, with the test playing the far end through the master side
+//
+
+#ifndef _SERIALPORTTESTPTY_H_
+#define _SERIALPORTTESTPTY_H_
+
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+class SerialPortTestPty
+{
+public:
+	SerialPortTestPty()
+	{
+		master = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		char slavePath[128];
+		if (master != -1 && grantpt (master) == 0 && unlockpt (master) == 0 && ptsname_r (master, slavePath, sizeof (slavePath)) == 0)
+			path = slavePath;
+	}
+	~SerialPortTestPty()
+	{
+		if (master != -1)
+			::close (master);
+	}
+	bool isOpen() const { return path.isNotEmpty(); }
+
+	//as much as the pty will take without waiting
+	size_t send (const void* data, size_t numBytes)
+	{
+		const auto written = ::write (master, data, numBytes);
+		return written > 0 ? (size_t) written : 0;
+	}
+	//waits up to timeoutMs for numBytes, and returns how many came
+	size_t receive (void* data, size_t numBytes, int timeoutMs)
+	{
+		const auto deadline = juce::Time::getMillisecondCounterHiRes() + timeoutMs;
+		size_t received = 0;
+		while (received < numBytes)
+		{
+			const auto remaining = (int) std::ceil (deadline - juce::Time::getMillisecondCounterHiRes());
+			pollfd fd { master, POLLIN, 0 };
+			if (remaining <= 0 || poll (&fd, 1, remaining) <= 0)
+				break;
+			const auto numRead = ::read (master, (juce::uint8*) data + received, numBytes - received);
+			if (numRead <= 0 && errno != EAGAIN && errno != EINTR)
+				break;
+			received += (size_t) juce::jmax ((ssize_t) 0, numRead);
+		}
+		return received;
+	}
+
+	//the whole process's user and system time, for the cpu per megabyte figures
+	static double getProcessCpuSeconds()
+	{
+		struct rusage usage;
+		getrusage (RUSAGE_SELF, &usage);
+		return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+	}
+
+	int master = -1;
+	juce::String path;
+};
+
+#endif //_SERIALPORTTESTPTY_H_
@@ -0,0 +1,169 @@
+//SerialPortTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+#include "SerialPortTestPty.h"
+
+class SerialPortTests : public UnitTest
+{
+public:
+	SerialPortTests() : UnitTest ("SerialPort", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("data goes both ways over a pty");
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, SerialPortConfig (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1,
+														 SerialPortConfig::FLOWCONTROL_NONE), nullptr);
+			expect (port.exists(), "couldn't open " + pty.path);
+			if (! port.exists())
+				return;
+			SerialPortInputStream input (&port);
+			SerialPortOutputStream output (&port);
+
+			const char request[] = "hello over the pty\r\n";
+			char received[64] = {};
+			expect (output.write (request, sizeof (request) - 1));
+			expectEquals ((int) pty.receive (received, sizeof (request) - 1, 1000), (int) sizeof (request) - 1, "the write didn't reach the far end");
+			expect (memcmp (request, received, sizeof (request) - 1) == 0);
+
+			//anything the tty did to it, like echoing it back or turning the line ending round, would show up here
+			const char reply[] = "and back again\r\n";
+			expectEquals ((int) pty.send (reply, sizeof (reply) - 1), (int) sizeof (reply) - 1);
+			expectEquals (input.readAtLeast (received, sizeof (reply) - 1, sizeof (received), 1000), (int) sizeof (reply) - 1, "the reply didn't come back whole");
+			expect (memcmp (reply, received, sizeof (reply) - 1) == 0);
+			expectEquals (input.readAtLeast (received, 1, sizeof (received), 100), 0, "more came back than was sent");
+		}
+
+		beginTest ("any baud rate can be set with termios2");
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, nullptr);
+			for (auto bitsPerSecond : { (uint32) 9600, (uint32) 250000, (uint32) 3000000, (uint32) 12000000 })
+			{
+				SerialPortConfig config (bitsPerSecond, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+				expect (port.setConfig (config), "couldn't set " + String (bitsPerSecond));
+				SerialPortConfig applied;
+				expect (port.getConfig (applied));
+				expectEquals (applied.bps, bitsPerSecond);
+			}
+		}
+
+		beginTest ("setBaudRate() changes the speed and nothing else");
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, nullptr);
+			expect (port.setConfig (SerialPortConfig (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_2,
+													  SerialPortConfig::FLOWCONTROL_NONE)));
+			for (auto bitsPerSecond : { (uint32) 921600, (uint32) 1500000, (uint32) 115200 })
+			{
+				expect (port.setBaudRate (bitsPerSecond), "couldn't switch to " + String (bitsPerSecond));
+				SerialPortConfig applied;
+				expect (port.getConfig (applied));
+				expectEquals (applied.bps, bitsPerSecond);
+				expectEquals ((int) applied.stopbits, (int) SerialPortConfig::STOPBITS_2, "switching speed changed the stop bits");
+			}
+		}
+
+		beginTest ("setBaudRate() on a port that was never given a config");
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, nullptr);
+			for (auto bitsPerSecond : { (uint32) 57600, (uint32) 2000000 })
+			{
+				expect (port.setBaudRate (bitsPerSecond), "couldn't switch to " + String (bitsPerSecond));
+				SerialPortConfig applied;
+				expect (port.getConfig (applied));
+				expectEquals (applied.bps, bitsPerSecond);
+			}
+		}
+
+		beginTest ("cancel() wakes a reader waiting on a quiet port");
+		{
+			SerialPortTestPty pty;
+			SerialPort port (pty.path, nullptr);
+			SerialPortInputStream input (&port);
+			Reader reader (input);
+			reader.startThread();
+			Thread::sleep (100);
+			expect (! reader.finished, "the reader returned without any data");
+			const auto start = Time::getMillisecondCounterHiRes();
+			port.cancel();
+			reader.waitForThreadToExit (2000);
+			expect (reader.finished, "the reader was still waiting");
+			//the stream thread wakes the caller as it stops
+			expectLessThan (Time::getMillisecondCounterHiRes() - start, 20.0, "cancel() took too long to reach the reader");
+		}
+
+		beginTest ("a port the reactor gives up on wakes a reader waiting on it");
+		{
+			SerialPortReactor reactor;
+			std::unique_ptr<SerialPortTestPty> pty (new SerialPortTestPty());
+			SerialPort port (pty->path, nullptr);
+			SerialPortInputStream input (&port, reactor);
+			Reader reader (input);
+			reader.startThread();
+			Thread::sleep (100);
+			expect (! reader.finished, "the reader returned without any data");
+			//closing the master hangs the port up
+			const auto start = Time::getMillisecondCounterHiRes();
+			pty.reset();
+			reader.waitForThreadToExit (2000);
+			expect (reader.finished, "the reader was still waiting");
+			expectLessThan (Time::getMillisecondCounterHiRes() - start, 20.0, "the hang up took too long to reach the reader");
+		}
+
+		beginTest ("openAll() opens every port it can, and says which it couldn't");
+		{
+			OwnedArray<SerialPortTestPty> ptys;
+			StringArray paths;
+			for (int i = 0; i < 6; ++i)
+			{
+				paths.add (ptys.add (new SerialPortTestPty())->path);
+				if (i % 3 == 1)
+					paths.add ("/dev/serialport-test-missing-" + String (i));
+			}
+			const SerialPortConfig config (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+			OwnedArray<SerialPort::OpenedPort> results;
+			SerialPort::openAll (paths, config, results, 3);
+			expectEquals (results.size(), paths.size(), "there isn't a result for every path");
+			for (int i = 0; i < results.size() && i < paths.size(); ++i)
+			{
+				auto* opened = results[i];
+				expectEquals (opened->path, paths[i], "the results aren't in the order of the paths");
+				const bool missing = paths[i].contains ("missing");
+				expect (missing == (opened->port == nullptr), missing ? "a path that isn't there was opened" : "couldn't open " + paths[i]);
+				expect (opened->milliseconds >= 0.0 && opened->milliseconds < 1000.0, "the time taken isn't believable");
+				SerialPortConfig applied;
+				if (opened->port != nullptr && opened->port->getConfig (applied))
+					expectEquals (applied.bps, config.bps, "the port wasn't configured");
+			}
+		}
+	}
+
+private:
+	//waits for a byte that never comes
+	struct Reader : public Thread
+	{
+		Reader (SerialPortInputStream& s) : Thread ("SerialTestReader"), stream (s) {}
+		void run() override
+		{
+			char c;
+			stream.readAtLeast (&c, 1, 1);
+			finished = true;
+		}
+		SerialPortInputStream& stream;
+		std::atomic<bool> finished { false };
+	};
+};
+
+static SerialPortTests serialPortTests;
+
+#endif // JUCE_LINUX
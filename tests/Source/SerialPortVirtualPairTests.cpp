@@ -0,0 +1,164 @@
+//SerialPortVirtualPairTests.cpp
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include "../../juce_serialport.h"
+
+class SerialPortVirtualPairTests : public UnitTest
+{
+public:
+	SerialPortVirtualPairTests() : UnitTest ("SerialPortVirtualPair", "SerialPort") {}
+
+	void runTest() override
+	{
+		beginTest ("a paced line delivers at its baud rate");
+		checkPacing();
+		beginTest ("the same seed puts the same errors in the same places");
+		checkSeededErrors();
+		beginTest ("every byte sent is delivered or counted as lost");
+		checkLostBytes();
+		beginTest ("closing one end leaves the other end's streams working");
+		checkClosingOneEnd();
+	}
+
+private:
+	static SerialPortVirtualPair::LineConditions paced (uint32 bitsPerSecond)
+	{
+		SerialPortVirtualPair::LineConditions conditions;
+		conditions.bitsPerSecond = bitsPerSecond;
+		return conditions;
+	}
+
+	static void fill (HeapBlock<uint8>& block, size_t numBytes)
+	{
+		for (size_t i = 0; i < numBytes; ++i)
+			block[i] = (uint8) (i % 251);
+	}
+
+	//2304 bytes at 115200 with 10 bits a byte is 200ms on the wire
+	void checkPacing()
+	{
+		SerialPortVirtualPair pair;
+		pair.setLineConditions (0, paced (115200));
+		SerialPortOutputStream output (&pair.getEnd (0));
+		SerialPortInputStream input (&pair.getEnd (1));
+		const int numBytes = 2304;
+		HeapBlock<uint8> sent (numBytes), received (numBytes);
+		fill (sent, numBytes);
+
+		const auto start = Time::getMillisecondCounterHiRes();
+		expect (output.write (sent, numBytes));
+		expectGreaterThan (pair.getNumBytesInFlight (0), (size_t) 0, "the line sent everything at once");
+		expectEquals (input.readExactly (received, numBytes, 2000), numBytes, "not everything arrived");
+		const auto elapsed = Time::getMillisecondCounterHiRes() - start;
+		expect (memcmp (sent, received, numBytes) == 0, "the data arrived changed");
+		expectGreaterThan (elapsed, 190.0, "the line went faster than its baud rate");
+		expectLessThan (elapsed, 400.0, "the line went much slower than its baud rate");
+		expect (pair.drain (0, 100));
+		expectEquals (pair.getNumBytesInFlight (0), (size_t) 0);
+	}
+
+	//sends numBytes over a fresh pair with the given conditions, and returns what arrived
+	MemoryBlock sendWithErrors (const SerialPortVirtualPair::LineConditions& conditions, size_t numBytes,
+								SerialPortVirtualPair::LineCounts& counts)
+	{
+		SerialPortVirtualPair pair;
+		pair.setLineConditions (0, conditions);
+		SerialPortOutputStream output (&pair.getEnd (0));
+		SerialPortInputStream input (&pair.getEnd (1), numBytes);
+		HeapBlock<uint8> sent (numBytes);
+		fill (sent, numBytes);
+		expect (output.write (sent, numBytes));
+		counts = pair.getLineCounts (0);
+		MemoryBlock received (numBytes);
+		const auto numRead = input.readAtLeast (received.getData(), (int) numBytes, (int) numBytes, 0);
+		received.setSize ((size_t) jmax (0, numRead));
+		return received;
+	}
+
+	void checkSeededErrors()
+	{
+		SerialPortVirtualPair::LineConditions conditions;
+		conditions.parityErrorRate = 0.01;
+		conditions.overrunRate = 0.002;
+		conditions.dropRate = 0.005;
+		conditions.seed = 42;
+		const size_t numBytes = 20000;
+		SerialPortVirtualPair::LineCounts first, second, other;
+		const auto firstReceived = sendWithErrors (conditions, numBytes, first);
+		const auto secondReceived = sendWithErrors (conditions, numBytes, second);
+		expectGreaterThan (first.parityErrors, (uint64) 0, "no errors were put in");
+		expectGreaterThan (first.overruns, (uint64) 0, "no overruns were put in");
+		expect (firstReceived == secondReceived, "the same seed gave different data");
+		expectEquals (second.parityErrors, first.parityErrors);
+		expectEquals (second.overruns, first.overruns);
+		expectEquals (second.bytesLost, first.bytesLost);
+
+		conditions.seed = 43;
+		expect (sendWithErrors (conditions, numBytes, other) != firstReceived, "a different seed gave the same data");
+	}
+
+	void checkLostBytes()
+	{
+		const size_t numBytes = 50000;
+		{
+			//parity errors change bytes without losing any
+			SerialPortVirtualPair::LineConditions conditions;
+			conditions.parityErrorRate = 0.01;
+			SerialPortVirtualPair::LineCounts counts;
+			const auto received = sendWithErrors (conditions, numBytes, counts);
+			expectEquals (received.getSize(), numBytes);
+			expectEquals (counts.bytesLost, (uint64) 0);
+			uint64 numChanged = 0;
+			for (size_t i = 0; i < received.getSize(); ++i)
+				numChanged += received[(int) i] != (char) (uint8) (i % 251) ? 1 : 0;
+			expectEquals (numChanged, counts.parityErrors, "the bytes changed don't match the parity errors counted");
+		}
+		{
+			SerialPortVirtualPair::LineConditions conditions;
+			conditions.overrunRate = 0.002;
+			conditions.overrunLength = 16;
+			conditions.dropRate = 0.005;
+			SerialPortVirtualPair::LineCounts counts;
+			const auto received = sendWithErrors (conditions, numBytes, counts);
+			expectEquals (counts.bytesSent, (uint64) numBytes);
+			expectEquals (counts.bytesDelivered, (uint64) received.getSize(), "the far end didn't get what was delivered");
+			expectEquals (counts.bytesDelivered + counts.bytesLost, counts.bytesSent, "bytes went missing without being counted as lost");
+			expectGreaterThan (counts.overruns, (uint64) 0, "no overruns were put in");
+			expectGreaterThan (counts.bytesLost, counts.overruns, "the overruns and drops didn't lose their bytes");
+		}
+	}
+
+	//a virtual port's close() only cancels it, so the line carries on and the far end's streams don't notice
+	void checkClosingOneEnd()
+	{
+		SerialPortVirtualPair pair;
+		pair.setLineConditions (0, paced (1000000));
+		std::unique_ptr<SerialPortOutputStream> nearOutput (new SerialPortOutputStream (&pair.getEnd (0)));
+		SerialPortInputStream farInput (&pair.getEnd (1));
+		SerialPortOutputStream farOutput (&pair.getEnd (1));
+		const int numBytes = 1000;
+		HeapBlock<uint8> sent (numBytes), received (numBytes);
+		fill (sent, numBytes);
+		expect (nearOutput->write (sent, numBytes));
+		nearOutput = nullptr;
+		pair.getEnd (0).close();
+
+		expectEquals (farInput.readExactly (received, numBytes, 1000), numBytes, "what was on the way didn't arrive");
+		expect (memcmp (sent, received, numBytes) == 0, "the data arrived changed");
+		//with no input stream at the closed end, what the far end sends goes nowhere, and says so
+		expect (farOutput.write (sent, 100));
+		expect (pair.drain (1, 1000));
+		expectEquals (pair.getLineCounts (1).bytesUnheard, (uint64) 100);
+		expectEquals (farInput.readAtLeast (received, 1, numBytes, 50), 0, "something arrived that wasn't sent");
+	}
+};
+
+static SerialPortVirtualPairTests serialPortVirtualPairTests;
+
+#endif // JUCE_LINUX